@@ -6,6 +6,13 @@
  * Input/Output (GPIO) pins and not through separate decoder or
  * controller hardware.
  *
+ * The driver is written for Linux 6.14 and later, which it needs for the
+ * hrtimer_setup and devm_fwnode_gpiod_get calls, the platform driver
+ * remove callback returning nothing, and binary sysfs attributes whose
+ * callbacks all take a constant attribute (listed through "bin_attrs_new"
+ * before Linux 6.16).  It builds as an external module ("make") against
+ * the headers of the running kernel.
+ *
  * Simple segmented LED devices are common-anode or common-cathode in nature,
  * where for each digit all the anodes or all the cathodes are connected to
  * a single pin, which selects (turns on or off) that digit.  Other pins
@@ -34,9 +41,16 @@
  * to be kept on twice as long as a '1', because only 2 segments are lit for
  * a '1' versus 4 segments for a '4').
  *
- * Only seven-segment devices (really eight-segment, but the decimal point
- * segment is often not counted) are currently supported by this driver.
- * The LED segments are spatially arranged and labeled according to the
+ * Seven-segment devices (really eight-segment, but the decimal point
+ * segment is often not counted) are supported by this driver, as are
+ * fourteen- and sixteen-segment alphanumeric devices, selected by adding
+ * 'segments = <14>;' or 'segments = <16>;' to the device in the device tree.
+ * The segment GPIOs of a fourteen-segment device are "sa" to "sf", "sg1",
+ * "sg2", "sh" to "sm" and "sp" (the decimal point), following the Wikipedia
+ * entry for "Fourteen-segment display"; those of a sixteen-segment device
+ * are the same except that the top and bottom segments are split into
+ * "sa1"/"sa2" and "sd1"/"sd2".  For seven-segment devices,
+ * the LED segments are spatially arranged and labeled according to the
  * following, which is consistent with the de-facto standard described in
  * Wikipedia entry for "Seven-segment display"
  * (https://en.wikipedia.org/wiki/Seven-segment_display):
@@ -70,6 +84,262 @@
  *   11     Segment A anode
  *   12     Digit 1 cathode
  *
+ * Devices with other numbers of digits are supported as well, up to 32.
+ * The driver counts the digit GPIOs given for the device in the device tree
+ * ("d1-gpio", "d2-gpio", and so on, stopping at the first one missing).
+ *
+ * Dot-matrix LED panels (for example 5x7 or 8x8 modules) are supported as
+ * well, and are scanned one row at a time in the same way as digits.  Such
+ * a panel is described in the device tree by a "columns" property giving its
+ * number of columns, with column GPIOs "c1", "c2", and so on in place of the
+ * segment GPIOs, and row GPIOs "r1", "r2", and so on in place of the digit
+ * GPIOs.  Text written to its "digits" attribute is drawn from the left
+ * using a built-in 5x7 font, with a blank column between characters, as
+ * many characters as fit across the panel (at least one).  Decimal points
+ * are not shown on dot-matrix panels.
+ *
+ * Changes to what a panel shows and how it shows it may also be made all at
+ * once through its "frame" attribute, as settings separated by spaces, for
+ * example "brightness=80 refresh=120 digits=12.34".  The settings are
+ * "brightness", "refresh", "digit_brightness", "blink" and "digit_blink"
+ * (as for the attributes of the same names, but with commas between the
+ * values for each digit, and a colon between the period and percentage of
+ * blinking, as in "blink=500:50 digit_blink=0,0,250:25"), "color" (for
+ * color panels, the color of all the digits, in RRGGBB form) and "digits"
+ * (the characters to show, as for the "digits" attribute), which comes last
+ * and runs to the end of the line.  Settings not given are left as they
+ * are.  Nothing changes if any setting is invalid, and otherwise all of
+ * them take effect together from the start of the next scanning cycle, so
+ * no mix of old and new settings is ever shown.  Reading it gives the
+ * brightness, refresh rate and characters in the same form.  (The
+ * brightness of a panel dimmed by a PWM is set right away, though.)
+ *
+ * Each digit may be made dimmer than the rest of its panel through the
+ * "digit_brightness" attribute, giving the brightness of each digit in turn,
+ * in percent of the brightness of the panel, separated by spaces (for
+ * example "100 100 50 50").  If fewer values are given than there are
+ * digits, the last one given is used for the rest.  The new brightness is
+ * latched at the start of the next scanning cycle.  It scales the time each
+ * digit is lit within its slot, so it costs nothing while scanning.  On
+ * dot-matrix panels each value applies to a row.  Charlieplexed panels, and
+ * panels driven by a controller, ignore it.
+ *
+ * A panel may be blinked through its "blink" attribute, giving a period in
+ * milliseconds and the percentage of it the panel is lit for (for example
+ * "500 50" to blink at 2 Hz, the percentage being 50 if not given), or zero
+ * to stop blinking.  Digits may also blink on their own through the
+ * "digit_blink" attribute, giving the same for each digit in turn, separated
+ * by spaces, with a colon before each percentage (for example "0 0 250:25").
+ * If fewer values are given than there are digits, the last one given is
+ * used for the rest.  Changes of brightness may be faded in over the number
+ * of milliseconds given by the "fade_ms" attribute (zero, the default, for
+ * right away).  Blinking and fading are worked out by the driver at the
+ * start of each scanning cycle, by lighting each slot for less of its time
+ * (or not at all), so they need no timers of their own.  Panels dimmed by a
+ * PWM blink but don't fade, charlieplexed panels don't blink one digit at a
+ * time, and panels driven by an HT16K33 controller don't fade, and only
+ * blink as a whole, half the time on, with the chip's own period nearest
+ * the one given (half a second, one second or two seconds).
+ *
+ * Text may also be shown over the digits of a panel in up to four layers,
+ * so that alarms or maintenance messages can be shown over a readout
+ * without replacing it.  Each line written to the "layers" attribute gives
+ * the number of a layer (1 to 4, the higher ones on top), how long to show
+ * it for in milliseconds (zero for until it is replaced) and the characters
+ * to show, as for the "digits" attribute (for example "2 5000 AL").  A line
+ * such as "2 clear" removes a layer.  Each digit shows the topmost layer
+ * which isn't blank there (a blank with no decimal point lets the layers
+ * below show through), or else the digits of the panel itself.  The layers
+ * are worked into the frame when it is staged, so scanning does no extra
+ * work, and expired layers are dropped by the driver at the start of the
+ * next scanning cycle.  Reading the attribute gives the active layers in
+ * the same form, with the time they have left.  Layers aren't shown over
+ * segments given as they are (through the "segments" attribute, a shared
+ * frame or a frame queue), and panels driven by a controller don't support
+ * them.
+ *
+ * Text longer than a panel can be scrolled across it by the driver itself,
+ * through the "message" and "scroll_step_ms" attributes, which work as they
+ * do for the auxdisplay drivers in the kernel.  A message is shown one
+ * character per digit (a trailing newline is dropped), and if it is longer
+ * than the panel it scrolls along by one character every "scroll_step_ms"
+ * milliseconds (500 by default, or zero to stop it), wrapping around to its
+ * start.  Each step is switched in at the start of a scanning cycle.
+ * Writing to the "digits" attribute replaces the message, as before.
+ *
+ * For animations, frames can be queued up to be shown one after another,
+ * switching at the start of a scanning cycle without any help from
+ * userspace.  Each line written to the "queue" attribute queues one frame,
+ * as a duration in milliseconds followed by the characters to show for it
+ * (for example "250 12.34"), or as "@" and a time of the monotonic clock in
+ * nanoseconds to show it at (for example "@5000000000 12.34"), which is
+ * handy for keeping a display in step with audio or video.  A line "loop"
+ * makes the queue start over once all its frames have been shown, and a
+ * line "clear" empties it.  Up to 64 frames can be queued at a time; a
+ * write which doesn't fit fails with ENOSPC and queues none of its frames.
+ * Reading the attribute gives the number still to show.  Each frame is
+ * timed from when the one before it was due, so timing doesn't drift.  A
+ * frame with a duration of 0 (or a time) stays shown until the next frame
+ * is due.  Once the queue runs out of frames while the last one's duration
+ * is up, that frame stays shown, and the "queue_underruns" attribute counts
+ * it, so a program topping up the queue can tell if it fell behind.  Panels
+ * driven by an HT16K33 controller have no scanning cycle, and can't queue
+ * frames.
+ *
+ * The segments lit for each digit may also be written directly to the
+ * "segments" binary attribute, bypassing the conversion from characters, for
+ * custom glyphs, bar graphs and the like.  It takes a bitmap for every digit
+ * at once, as one native-endian word per digit: one byte for seven-segment
+ * panels (segment A in the lowest bit and the decimal point in the highest),
+ * two bytes for fourteen-segment panels and four bytes for sixteen-segment
+ * panels (in the order of their segment GPIOs), and for dot-matrix panels
+ * a byte, two bytes or four bytes per row, as the number of columns
+ * requires.  Writing bits above the segments (or columns) of the panel
+ * fails with EINVAL.  Reading it gives the bitmaps being shown, including
+ * those converted from characters.
+ *
+ * The map used to convert characters into segments can be replaced at
+ * runtime through the "map_seg7", "map_seg14" or "map_seg16" binary
+ * attribute of a segmented panel, whichever matches its kind.  The map is
+ * read and written whole, in the format of struct seg7_conversion_map (or
+ * seg14_conversion_map, or seg16_conversion_map from map_to_16segment.h)
+ * used by other auxdisplay drivers, and each panel starts out with the
+ * standard map.  A new map takes effect in one go, redrawing the characters
+ * shown with it from the start of the next scanning cycle (segments written
+ * as they are stay as they are, and only later text uses the new map).
+ *
+ * Several panels can also be presented as one longer display by adding a
+ * node with a "panels" property listing them in order from left to right,
+ * for example 'panels = <&panel0 &panel1>;'.  The resulting device has its
+ * own "digits" attribute which takes the text for the whole display at once,
+ * and its own "refresh" attribute which sets the refresh rate of all the
+ * panels.  The panels scan in step with each other, and text written to the
+ * display is shown on all of them starting with the same scanning cycle.
+ *
+ * Each panel also has a character device, "/dev/segled0", "/dev/segled1"
+ * and so on, numbered in the order panels are added.  Text written to it
+ * is shown in the same way as text written to the "digits" attribute,
+ * without having to open the attribute again or seek back to its start.
+ * Reading from it waits for a new frame to be fully scanned out (or fails
+ * with EAGAIN if opened non-blocking and there is none yet), then gives two
+ * 64-bit numbers in native byte order: how many frames the panel has shown,
+ * and the time in nanoseconds of the monotonic clock when the latest of
+ * them was first fully scanned out (see struct segled_frame_event in
+ * segled-core.h).  Polling it reports it readable at the same moment, so a
+ * program can pace its updates to the scanning of the panel.
+ *
+ * The character device may also be mapped (one page, shared), giving a
+ * struct segled_shared_frame (see segled-core.h) holding the segments of
+ * each digit, as for the "segments" attribute (but with any bits above the
+ * segments of the panel ignored), and the brightness.  A program publishes
+ * a frame by making the sequence number in it odd, writing the frame and
+ * then making the sequence number even again, without any system calls.  At
+ * the start of each scanning cycle, the driver takes the latest frame
+ * published, if it reads the same sequence number before and after it, and
+ * otherwise tries again at the next cycle.  The segled-writer.hpp header
+ * does this for C++20 programs.  Panels driven by an HT16K33 controller
+ * have no scanning cycle, and can't be mapped.
+ *
+ * Seven-segment RGB devices, with a red, a green and a blue LED in each
+ * segment, are supported by adding "rgb;" to the device in the device tree.
+ * Each segment then has a GPIO for each color channel, named after the
+ * segment and the channel ("sa-red", "sa-green", "sa-blue", and so on), and
+ * the digits share their common pins across the channels.  The driver shows
+ * each channel of each digit in a slot of its own, with a duty cycle in
+ * proportion to the level of the channel in the color of the digit, and
+ * skips channels that are off.  The color of each digit, in hexadecimal
+ * RRGGBB form, is set through the "colors" attribute (for example
+ * "ff0000 00ff00 0000ff ffffff"), or for all the digits at once by starting
+ * what is written to "digits" with it (for example "#ff8000 12.34").  The
+ * "segments" attribute of a color panel takes a 32-bit word per digit, with
+ * the red, green and blue segments in turn, so that each segment can be
+ * given a color of its own.  Setting the colors of such a frame keeps its
+ * segments, and only changes the level of each channel.
+ *
+ * Segmented devices may also be charlieplexed, which lets a handful of pins
+ * drive many LEDs: with N pins, up to N*(N-1) LEDs, each wired between a
+ * different pair of pins.  Such a panel is described in the device tree by
+ * its pins ("p1-gpio", "p2-gpio", and so on) and a "charlieplex-leds"
+ * property listing, for each segment of each digit in turn (decimal point
+ * last), the numbers of the pins wired to the anode and cathode of its LED,
+ * or 0 0 if there is none.  The number of digits follows from the length of
+ * the list.  Each time the digits change, the driver plans how to light the
+ * segments with as few combinations of pins driven high and low as it can,
+ * and the scanning cycle then steps through those combinations, leaving all
+ * other pins as inputs.  A charlieplexed panel cannot share its pins with
+ * other panels, and "seg-adjust" has no effect on it.
+ *
+ * Segmented devices may also be driven through a chain of 74HC595 (or similar)
+ * shift registers, so that a panel needs only three GPIOs however many digits
+ * it has.  Such a panel is described in the device tree by its "data-gpio",
+ * "clock-gpio" and "latch-gpio" and the number of digits it has ("digits").
+ * The segments are wired to the first outputs of the chain, in the usual
+ * order with the decimal point last, and the digit commons to the outputs
+ * after them, and all of them must fit in 32 outputs.  For each slot of the
+ * scanning cycle, the driver shifts out the segments and the common of the
+ * digit together and latches them in one go.  Outputs that are active-low
+ * can be marked with "segments-active-low;" and "digits-active-low;".  A
+ * panel driven through shift registers cannot share them with other panels.
+ *
+ * Segmented devices of up to sixteen GPIOs (seven- and fourteen-segment) may
+ * also be driven by a Holtek HT16K33 LED controller, which does the scanning
+ * and dimming itself, so the driver only writes each new frame out to the
+ * chip, in one go, when it is latched.  Such a panel is described in the
+ * device tree by the I2C bus the chip is on ("i2c-bus"), its address on the
+ * bus ("i2c-address", 0x70 if not given) and the number of digits it has
+ * ("digits", up to eight), with the segments wired to the row outputs of the
+ * chip and the digit commons to its common outputs.  A bus with no device
+ * tree node of its own (such as one added by the i2c-stub module) may be
+ * given by its number instead ("i2c-adapter").  The "brightness"
+ * attribute maps onto the sixteen dimming levels of the chip, turning the
+ * display off at zero, and the chip scans at a fixed rate of its own, so
+ * "refresh" and "seg-adjust" have no effect on such a panel.
+ *
+ * Segment and digit GPIOs may be on I2C or SPI expander chips (such as the
+ * PCA9555 or MCP23017) rather than on the processor itself.  The driver
+ * can't tell such chips from any other, so it takes GPIOs whose chip may
+ * sleep (as chips on I2C and SPI buses do) to be on expanders.  When any
+ * GPIO of a panel (or of a group of panels sharing segment GPIOs) sleeps,
+ * the driver switches them all in one go for each slot, so that GPIOs on
+ * one expander chip take a single transfer for each slot (or one for each
+ * port, on chips that split their GPIOs across ports).  A transfer that
+ * fails is tried again straight away, up to twice more, and then given up
+ * on for that slot, so as not to hold up scanning for long; the GPIOs are
+ * then all set again in the next slot.  Failed transfers, retries included,
+ * are counted in the debugfs file named after the first panel on the bus
+ * followed by "-bus_errors", in a directory named after the driver's
+ * platform device.  Even so, the speed of the bus limits how fast such
+ * panels can be scanned, and so how many digits they can have without
+ * flicker.
+ *
+ * Which way the LEDs of a panel are driven is worked out from its other
+ * properties in the device tree, but may also be given outright ("backend"),
+ * as one of "gpio" (segment and digit GPIOs switched one at a time),
+ * "gpio-array" (switched all in one go, as for expander chips),
+ * "charlieplex", "shift-register", "ht16k33" or "simulated".  Giving
+ * "gpio" keeps GPIOs on expander chips switched one at a time.  Panels
+ * sharing segment GPIOs must all use the same backend.
+ *
+ * For trying out the driver on machines without any LEDs, a panel may be
+ * simulated, by adding "simulated;" and the number of digits it has
+ * ("digits") to it in the device tree, in place of any GPIOs.  A simulated
+ * panel is scanned just like any other, but rather than switching GPIOs, it
+ * records each slot of its scanning cycle.  The most recent slots recorded
+ * can be read from the debugfs file named after the panel, in a directory
+ * named after the driver's platform device, which gives the number of slots
+ * recorded in all, followed by one line for each slot with the time it
+ * started in nanoseconds, the digit (-1 if resting) and the
+ * segments lit, in hexadecimal.
+ *
+ * Panels may also share segment GPIOs, with only their digit GPIOs kept
+ * separate, by listing the same segment GPIOs for each of them in the device
+ * tree.  Panels sharing segment GPIOs are scanned together as one group, one
+ * digit at a time across all of them, so every digit gets an equal share of
+ * the scanning cycle and the panels share one "refresh" rate.  Panels must
+ * share either all of their segment GPIOs or none of them, and only one
+ * panel in a group may have a frame sync GPIO (see note 4 below), which then
+ * applies to the whole group.
+ *
  * Notes for hardware designers:
  * 1. The component has no internal current limiters, and so requires
  *    resistors or other such current limiters in an any actual design.
@@ -84,6 +354,25 @@
  *    GPIO pin can drive.  NPN transistors can be used to provide the
  *    additional current.  For an example, see the following
  *      http://learn.parallax.com/4-digit-7-segment-led-display-arduino-demo
+ *
+ * 4. If the display will be filmed, a frame sync signal from the camera
+ *    (for example, a vertical sync pulse) can be wired to a GPIO and
+ *    added to the device in the device tree as "sync-gpio".  The driver
+ *    will then lock its scanning cycle to the rising edges of the signal,
+ *    so that whole cycles fit within each camera exposure and no rolling
+ *    bars appear.  By default the driver phase-locks to the measured
+ *    period of the signal ("pll"); add 'sync-mode = "rephase";' to instead
+ *    restart the cycle at each edge.  The "sync_mode", "sync_locked",
+ *    "sync_phase_error" and "sync_period" attributes of the device
+ *    select the mode and report how well the lock is holding.
+ *
+ * 5. If the digit selectors (or a driver chip's output enable feeding
+ *    them) are gated by a PWM-capable pin, the PWM can be added to the
+ *    device in the device tree ("pwms").  The "brightness" attribute then
+ *    sets the duty cycle of the PWM, and each digit is lit for its whole
+ *    slot, so the scanning timer ticks only once per slot.  Color levels
+ *    and "seg-adjust" still shorten slots as before.  This is not
+ *    supported for panels driven by an HT16K33 controller.
  */
 
 /**
@@ -94,26 +383,55 @@
  */
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/gpio.h>
 #include <linux/gpio/consumer.h>
 #include <linux/hrtimer.h>
+#include <linux/i2c.h>
+#include <linux/idr.h>
+#include <linux/interrupt.h>
 #include <linux/kernel.h>
 #include <linux/kobject.h>
+#include <linux/map_to_14segment.h>
 #include <linux/map_to_7segment.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/pwm.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
+#include "font_5x7.h"
+#include "map_to_16segment.h"
+#include "segled-core.h"
+
 /**
- * This is the number of digits the device is expected to have.
- *
- * @todo
- *     Lift this restriction and get the actual number of digits
- *     from the device tree.
+ * Attribute groups list constant binary attributes through
+ * "bin_attrs_new" until Linux 6.16, where "bin_attrs" takes them over.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define GPIO_SEGLED_BIN_ATTRS bin_attrs_new
+#else
+#define GPIO_SEGLED_BIN_ATTRS bin_attrs
+#endif
+
+/**
+ * This is the maximum number of digits a device may have.  The actual
+ * number of digits is the number of digit GPIOs ("d1", "d2", ...)
+ * listed for the device in the device tree.
  */
-#define NUM_DIGITS 4
+#define MAX_DIGITS 32
 
 /**
  * This is the default rate at which to "scan" the digits of the
@@ -128,30 +446,151 @@
 #define DEFAULT_BRIGHTNESS_PERCENT 100
 
 /**
- * These are the internal identifiers of the GPIOs that
- * are expected of the device.
+ * This is the fraction of a scanning cycle (one over this number) within
+ * which a cycle must start relative to the external frame sync signal
+ * in order for the device to be considered locked to it.
+ */
+#define SYNC_LOCK_DIVISOR 100
+
+/**
+ * This is the number of consecutive scanning cycles which must start
+ * within the lock window before the device is considered locked to the
+ * external frame sync signal.
+ */
+#define SYNC_LOCK_CYCLES 8
+
+/**
+ * This is the gain of the phase-locked loop used to follow the external
+ * frame sync signal.  Each scanning cycle, one over this number of the
+ * measured phase error is corrected.
+ */
+#define SYNC_PLL_GAIN 4
+
+/**
+ * This is the number of sync periods which may elapse without an edge on
+ * the external frame sync signal before the device gives up on it and
+ * falls back to free-running at the configured refresh rate.
+ */
+#define SYNC_TIMEOUT_PERIODS 4
+
+/**
+ * This is how far ahead, in nanoseconds, a frame committed to a virtual
+ * display is scheduled, at the least, so that it can be staged on all
+ * of its panels before any of them reach the cycle boundary at which
+ * the frame is to be latched.
+ */
+#define COMMIT_GUARD_NS 100000
+
+/**
+ * These are the ways the scanning cycle may be synchronized to an
+ * external frame sync signal ("sync" GPIO).
+ */
+enum gpio_segled_sync_mode {
+    // Free-run at the configured refresh rate, ignoring any sync signal.
+    SEGLED_SYNC_NONE = 0,
+
+    // Snap the start of the scanning cycle to each sync edge.
+    SEGLED_SYNC_REPHASE,
+
+    // Lock the scanning cycle to the measured period and phase of
+    // the sync signal, fitting a whole number of cycles into each period.
+    SEGLED_SYNC_PLL,
+
+    SEGLED_SYNC_MAX
+};
+
+/**
+ * These are the external identifiers of the sync modes, used both in
+ * the device tree ("sync-mode") and the "sync_mode" attribute.
+ */
+static const char* gpio_segled_sync_modes[SEGLED_SYNC_MAX] = {
+    "none",
+    "rephase",
+    "pll",
+};
+
+/**
+ * This is the largest number of segment GPIOs a device can have, which
+ * is the width of the segment bitmaps.  Segmented devices have up to
+ * seventeen (sixteen segments plus the decimal point), while dot-matrix
+ * devices have one for each column.
+ */
+#define MAX_SEGMENT_GPIOS 32
+
+/**
+ * This is the largest number of digits on a bus, across all its panels,
+ * which is the width of the digit bitmaps.
+ */
+#define MAX_BUS_DIGITS 64
+
+/**
+ * This is the number of slots recorded for a simulated panel, which has
+ * no GPIOs, only a record of the most recent slots of its scanning cycle.
+ */
+#define SIMULATED_RECORDS 1024
+
+/**
+ * This is how many more times a failed transfer setting the GPIOs of a
+ * bus on expander chips is tried, straight away, before the slot is given
+ * up on.
  */
-enum gpio_segled_gpios {
-    SEGLED_GPIO_SEGMENT_A = 0,
-    SEGLED_GPIO_SEGMENT_B,
-    SEGLED_GPIO_SEGMENT_C,
-    SEGLED_GPIO_SEGMENT_D,
-    SEGLED_GPIO_SEGMENT_E,
-    SEGLED_GPIO_SEGMENT_F,
-    SEGLED_GPIO_SEGMENT_G,
-    SEGLED_GPIO_SEGMENT_P,
-    SEGLED_GPIO_DIGIT_1,
-    SEGLED_GPIO_DIGIT_2,
-    SEGLED_GPIO_DIGIT_3,
-    SEGLED_GPIO_DIGIT_4,
-    SEGLED_GPIO_MAX
+#define BUS_RETRIES 2
+
+/**
+ * This is the number of frames which can be queued for a panel, to be
+ * shown one after another.
+ */
+#define QUEUE_FRAMES 64
+
+/**
+ * This is the number of layers of text which can be shown over the digits
+ * of a panel.
+ */
+#define NUM_LAYERS 4
+
+/**
+ * This is the default time each step of a scrolling message is shown for,
+ * in milliseconds, as for other auxdisplay drivers.
+ */
+#define DEFAULT_SCROLL_STEP_MS 500
+
+/**
+ * These are the periods in milliseconds at which an HT16K33 controller can
+ * blink its whole display by itself, half the time on, indexed by the
+ * blinking rate given in its display setup command (zero for not blinking).
+ */
+static const unsigned int gpio_segled_controller_blink_periods_ms[] = {
+    0,
+    500,
+    1000,
+    2000,
 };
 
+/**
+ * These are the commands of the Holtek HT16K33 LED controller, which
+ * scans up to eight digits of up to sixteen segments by itself, from
+ * sixteen bytes of display RAM (two for each digit, low segments first).
+ */
+#define HT16K33_CMD_RAM         0x00
+#define HT16K33_CMD_OSCILLATOR  0x20
+#define HT16K33_CMD_DISPLAY     0x80
+#define HT16K33_CMD_ROW_INT     0xa0
+#define HT16K33_CMD_DIMMING     0xe0
+#define HT16K33_ON              0x01
+#define HT16K33_RAM_SIZE        16
+#define HT16K33_MAX_DIGITS      8
+#define HT16K33_MAX_SEGMENTS    16
+#define HT16K33_DIMMING_LEVELS  16
+#define HT16K33_BLINK_SHIFT     1
+#define HT16K33_DEFAULT_ADDRESS 0x70
+
 /**
  * These are the external identifiers (consumer identifiers in the
- * device tree) of the GPIOs that are expected of the device.
+ * device tree) of the segment GPIOs that are expected of a seven-segment
+ * device, in the bit order of the seven-segment conversion map, followed
+ * by the decimal point.
  */
-static const char* gpio_segled_gpio_consumers[SEGLED_GPIO_MAX] = {
+static const char* gpio_segled_seg7_consumers[] = {
     "sa",
     "sb",
     "sc",
@@ -160,332 +599,4613 @@ static const char* gpio_segled_gpio_consumers[SEGLED_GPIO_MAX] = {
     "sf",
     "sg",
     "sp",
-    "d1",
-    "d2",
-    "d3",
-    "d4",
 };
 
 /**
- * This is the state structure for a single LED panel.
+ * These are the external identifiers of the segment GPIOs that are
+ * expected of a fourteen-segment device, in the bit order of the
+ * fourteen-segment conversion map, followed by the decimal point.
  */
-struct gpio_segled_device {
-    // Linux driver model base
-    struct device dev;
-
-    // Attributes
-    char digits[NUM_DIGITS];
-    int decimal_points[NUM_DIGITS];
-    unsigned long refresh_rate_hz;
-    int brightness_percent;
-
-    // Internal state (non-attributes)
-    int resting;
-    int last_digit;
-    int active_digit;
-    int segments_out;
-    int duty_cycle_percent;
-
-    // seg-adjust - if set in the device tree, the design uses
-    // current limiters on the common anode/cathode pins, so we need
-    // to adjust duty cycles to match brightness across digits.
-    int seg_adjust;
+static const char* gpio_segled_seg14_consumers[] = {
+    "sa",
+    "sb",
+    "sc",
+    "sd",
+    "se",
+    "sf",
+    "sg1",
+    "sg2",
+    "sh",
+    "si",
+    "sj",
+    "sk",
+    "sl",
+    "sm",
+    "sp",
+};
 
-    // Kernel resources
-    struct gpio_desc* gpios[SEGLED_GPIO_MAX];
-    struct work_struct update_digits_work;
-    struct hrtimer digit_timer;
+/**
+ * These are the external identifiers of the segment GPIOs that are
+ * expected of a sixteen-segment device, in the bit order of the
+ * sixteen-segment conversion map, followed by the decimal point.
+ */
+static const char* gpio_segled_seg16_consumers[] = {
+    "sa1",
+    "sa2",
+    "sb",
+    "sc",
+    "sd1",
+    "sd2",
+    "se",
+    "sf",
+    "sg1",
+    "sg2",
+    "sh",
+    "si",
+    "sj",
+    "sk",
+    "sl",
+    "sm",
+    "sp",
 };
 
 /**
- * Define a standard seven-segment LED conversion map, used to convert
- * from a desired digit into the signals to send to each segment pin.
+ * Define the standard conversion maps, used to convert from a desired
+ * digit into the signals to send to each segment pin.
  */
 static SEG7_CONVERSION_MAP(gpio_segled_seg7map, MAP_ASCII7SEG_ALPHANUM_LC);
+static SEG14_CONVERSION_MAP(gpio_segled_seg14map, MAP_ASCII14SEG_ALPHANUM);
+static SEG16_CONVERSION_MAP(gpio_segled_seg16map, MAP_ASCII16SEG_ALPHANUM);
 
 /**
- * This function sets up the device state in preparation for driving
- * the digit and segments that are next in the scanning cycle.
- *
- * It is called directly from the scanning timer callback.
+ * This is the conversion map of a panel, of whichever kind its segmented
+ * LED device uses.  Each panel starts out with a copy of the standard map,
+ * which may be replaced through its "map_seg7", "map_seg14" or "map_seg16"
+ * attribute.
  */
-static void prepare_update_digits(struct gpio_segled_device* dev_impl) {
-    enum gpio_segled_gpios gpio;
-    int segments_out;
-    int segments_lit = 0;
+union gpio_segled_conversion_map {
+    struct seg7_conversion_map seg7;
+    struct seg14_conversion_map seg14;
+    struct seg16_conversion_map seg16;
+};
 
-    // If duty cycle is valid and less than 100%, alternate
-    // between resting (all digits off) and not resting (show active digit).
-    // Otherwise, never rest.
-    if (
-        (dev_impl->duty_cycle_percent > 0)
-        && (dev_impl->duty_cycle_percent < 100)
-    ) {
-        dev_impl->resting = !dev_impl->resting;
-    } else {
-        dev_impl->resting = 0;
-    }
+static int gpio_segled_map_seg7(union gpio_segled_conversion_map* map, int c) {
+    return map_to_seg7(&map->seg7, c);
+}
 
-    // Nothing else to configure if reseting.
-    if (dev_impl->resting) {
-        return;
-    }
+static int gpio_segled_map_seg14(union gpio_segled_conversion_map* map, int c) {
+    return map_to_seg14(&map->seg14, c);
+}
 
-    // Advance to next digit, returning to the first digit at the end.
-    if (++dev_impl->active_digit >= NUM_DIGITS) {
-        dev_impl->active_digit = 0;
-    }
+static int gpio_segled_map_seg16(union gpio_segled_conversion_map* map, int c) {
+    return map_to_seg16(&map->seg16, c);
+}
+
+/**
+ * This describes one kind of segmented LED device: how many segments
+ * make up each digit (not counting the decimal point), the consumer
+ * identifiers of its segment GPIOs, and how to convert a character into
+ * a bitmap of the segments to light, with the standard conversion map
+ * and its size.  The decimal point is always the segment GPIO following
+ * the last segment.
+ */
+struct gpio_segled_segment_type {
+    int segments;
+    int num_gpios;
+    const char** consumers;
+    int (*map)(union gpio_segled_conversion_map* map, int c);
+    const void* default_map;
+    size_t map_size;
+};
 
-    // Convert character to display into bitmap selecting the segment
-    // GPIOs to switch on in order to display the desired character.
-    segments_out = map_to_seg7(&gpio_segled_seg7map, dev_impl->digits[dev_impl->active_digit]);
+/**
+ * These are the kinds of segmented LED devices supported, selected
+ * in the device tree ("segments").
+ */
+static const struct gpio_segled_segment_type gpio_segled_segment_types[] = {
+    {
+        .segments = 7,
+        .num_gpios = ARRAY_SIZE(gpio_segled_seg7_consumers),
+        .consumers = gpio_segled_seg7_consumers,
+        .map = gpio_segled_map_seg7,
+        .default_map = &gpio_segled_seg7map,
+        .map_size = sizeof(gpio_segled_seg7map),
+    },
+    {
+        .segments = 14,
+        .num_gpios = ARRAY_SIZE(gpio_segled_seg14_consumers),
+        .consumers = gpio_segled_seg14_consumers,
+        .map = gpio_segled_map_seg14,
+        .default_map = &gpio_segled_seg14map,
+        .map_size = sizeof(gpio_segled_seg14map),
+    },
+    {
+        .segments = 16,
+        .num_gpios = ARRAY_SIZE(gpio_segled_seg16_consumers),
+        .consumers = gpio_segled_seg16_consumers,
+        .map = gpio_segled_map_seg16,
+        .default_map = &gpio_segled_seg16map,
+        .map_size = sizeof(gpio_segled_seg16map),
+    },
+};
 
-    // Mix in decimal point, if one is present at this position.
-    if (dev_impl->decimal_points[dev_impl->active_digit]) {
-        segments_out |= 0x80;
-    }
+/**
+ * These are the color channels of color (RGB) panels, in the order in
+ * which they are scanned, which is also the order of their segment GPIOs
+ * in the segment bitmaps.  Their names are appended to the consumer
+ * identifiers of the segment GPIOs ("sa-red", "sa-green", and so on).
+ */
+#define NUM_COLOR_CHANNELS 3
+static const char* gpio_segled_channel_names[NUM_COLOR_CHANNELS] = {
+    "red",
+    "green",
+    "blue",
+};
 
-    // Save GPIO selection bitmap for use when GPIOs are actually switched
-    // in execute_update_digits.
-    dev_impl->segments_out = segments_out;
+/**
+ * This is the color of each digit of a color panel until another is given.
+ */
+#define DEFAULT_COLOR 0xffffff
 
-    // Compute duty cycle as follows:
-    // 1. Start with brightness setting.
-    // 2. Factor in number of segments lit, if seg-adjust was set
-    //    in device tree.
-    dev_impl->duty_cycle_percent = dev_impl->brightness_percent;
-    if (dev_impl->seg_adjust) {
-        for (gpio = SEGLED_GPIO_SEGMENT_A; gpio <= SEGLED_GPIO_SEGMENT_P; ++gpio) {
-            if ((segments_out & 1) != 0) {
-                ++segments_lit;
-            }
-            segments_out >>= 1;
-        }
-        dev_impl->duty_cycle_percent = dev_impl->duty_cycle_percent * segments_lit / 8;
-    }
+/**
+ * This extracts the level (0-255) of one color channel from a color given
+ * in the usual 0xRRGGBB form.
+ */
+static int gpio_segled_color_level(u32 color, int channel) {
+    return (color >> (8 * (NUM_COLOR_CHANNELS - 1 - channel))) & 0xff;
 }
 
 /**
- * This function reconfigures the GPIOs to drive the digit and segments
- * that are next in the scanning cycle.
+ * This is how a panel, or a digit of it, blinks: on for the first
+ * duty_percent of every period_ms milliseconds and off for the rest, or
+ * steadily on if period_ms is zero.
+ */
+struct gpio_segled_blink {
+    unsigned int period_ms;
+    unsigned int duty_percent;
+};
+
+/**
+ * This holds one frame of what to show on a panel.  Besides the digits
+ * and decimal points as given (and the color of each digit, for color
+ * panels), it holds the bitmap of segment GPIOs to
+ * switch on for each digit, worked out when the frame is staged so that
+ * scanning needn't do any conversions.  For charlieplexed panels, it also
+ * holds the plan for lighting those segments: the bitmaps of the pins to
+ * drive high and low in each slot of the scanning cycle.
  *
- * It is called from a kernel worker process scheduled from the scanning
- * timer callback.
+ * The segments are worked out from the characters with any layers of the
+ * panel shown over them, unless they were given as they are (in which case
+ * raw_segments is set, and layers aren't shown).
+ *
+ * Each digit also has a brightness of its own, in percent of the brightness
+ * of the panel.  A frame may also carry a new brightness and refresh rate,
+ * set through the "frame" attribute, to take effect when it is latched (or
+ * -1 and 0 respectively, to leave them as they are), and new blinking for
+ * the panel and for each digit (if blink_given and digit_blink_given are
+ * set), which starts over, on, when the frame is latched.
  */
-static void execute_update_digits(struct work_struct* work) {
-    struct gpio_segled_device* dev_impl = container_of(work, struct gpio_segled_device, update_digits_work);
-    enum gpio_segled_gpios gpio;
-    int segments_out = dev_impl->segments_out;
+struct gpio_segled_frame {
+    char* digits;
+    int* decimal_points;
+    u32* colors;
+    u32* segments;
+    u8* digit_brightness;
+    u32* plan_high;
+    u32* plan_low;
+    struct gpio_segled_blink* digit_blink;
+    int raw_segments;
+    int brightness_percent;
+    unsigned long refresh_rate_hz;
+    struct gpio_segled_blink blink;
+    int blink_given;
+    int digit_blink_given;
+};
 
-    // Make sure the last digit lit is turned off.
-    gpiod_set_value_cansleep(dev_impl->gpios[SEGLED_GPIO_DIGIT_1 + dev_impl->last_digit], 0);
+/**
+ * This is a layer of text shown over the digits of a panel while active,
+ * up to the time given by expires_at (unless it is zero).  Digits left
+ * blank, with no decimal point, let whatever is below show through.
+ */
+struct gpio_segled_layer {
+    int active;
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    ktime_t expires_at;
+};
 
-    // Nothing else to do if resting.
-    if (dev_impl->resting) {
-        return;
-    }
+struct gpio_segled_bus;
 
-    // Switch GPIOs to match bitmap of desired character.
-    for (gpio = SEGLED_GPIO_SEGMENT_A; gpio <= SEGLED_GPIO_SEGMENT_P; ++gpio) {
-        gpiod_set_value_cansleep(dev_impl->gpios[gpio], (segments_out & 1));
-        segments_out >>= 1;
-    }
+struct gpio_segled_device;
+struct gpio_segled_driver;
 
-    // Light the active digit.
-    gpiod_set_value_cansleep(dev_impl->gpios[SEGLED_GPIO_DIGIT_1 + dev_impl->active_digit], 1);
-    dev_impl->last_digit = dev_impl->active_digit;
-}
+/**
+ * This is the record of a slot of the scanning cycle of a simulated
+ * panel: when the GPIOs would have been switched, and the digit (or -1
+ * if resting) and segments they would have been switched to.
+ */
+struct gpio_segled_record {
+    ktime_t time;
+    int digit;
+    u32 segments;
+};
 
 /**
- * This is the callback for the scanning timer.  It updates the device state
- * to reflect the next digit and segments to be driven, and schedules a work
- * item to reconfigure the GPIOs to match.
- *
- * The timer expiration is updated according to the proper duty cycle
- * configured for the current digit.
+ * This is the interface to the backend driving the LEDs of a bus, which
+ * may switch GPIOs, or shift the segments and digits out to registers,
+ * or hand them over to a controller chip, and so on.  Which backend a
+ * bus has is given in the device tree ("backend"), or else worked out
+ * from the other properties of its panels.
  */
-static enum hrtimer_restart gpio_segled_digit_timer_tick(struct hrtimer* data) {
-    struct gpio_segled_device* dev_impl = container_of(data, struct gpio_segled_device, digit_timer);
-    unsigned long period = 1000000000 / (NUM_DIGITS * dev_impl->refresh_rate_hz);
+struct segled_backend_ops {
+    // Name of the backend in the device tree
+    const char* name;
 
-    // Advance device state one step in the scanning cycle.
-    prepare_update_digits(dev_impl);
+    // This sets up the bus for a panel, acquiring what the backend needs
+    // to drive it, or finds the bus of another panel sharing it.
+    struct gpio_segled_bus* (*acquire)(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels);
 
-    // Calculate next timer period based on duty cycle and whether or
-    // not we're currently resting.
-    if (
-        (dev_impl->duty_cycle_percent > 0)
-        && (dev_impl->duty_cycle_percent < 100)
-    ) {
-        period = period / 100 * (dev_impl->resting ? (100 - dev_impl->duty_cycle_percent) : dev_impl->duty_cycle_percent);
-    }
+    // This finds out how many digits a panel has, acquiring anything the
+    // backend needs for them.
+    int (*acquire_panel)(struct platform_device* pdev, struct gpio_segled_device* dev_impl, struct fwnode_handle* child);
 
-    // Schedule GPIO switching.
-    (void)schedule_work(&dev_impl->update_digits_work);
+    // This lights the given segments of the given digits (a bitmap across
+    // all panels of the bus), for a slot of the scanning cycle.  For
+    // charlieplexed panels, the segments are the pins to drive low and the
+    // digits are the pins to drive high.
+    void (*apply)(struct gpio_segled_bus* bus, u32 segments, u64 digits);
 
-    // Update the timer to tick again when the current period expires.
-    hrtimer_add_expires_ns(&dev_impl->digit_timer, period);
-    return HRTIMER_RESTART;
-}
+    // For backends which do their own scanning, in place of apply, this
+    // writes out the latest frame and brightness whenever they change.
+    void (*update)(struct gpio_segled_bus* bus);
+
+    // This tells whether apply may sleep, in which case it is called from
+    // a work item rather than from the scanning timer callback.
+    int (*cansleep)(struct gpio_segled_bus* bus);
+
+    // This turns the LEDs off and lets go of anything acquired which isn't
+    // let go of automatically.
+    void (*release)(struct gpio_segled_bus* bus);
+};
 
 /**
- * This is called by the kernel whenever a device is removed.
+ * This is the state structure for a single LED panel.
  */
-static void gpio_segled_device_release(struct device* dev) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    (void)hrtimer_cancel(&dev_impl->digit_timer);
-    (void)cancel_work_sync(&dev_impl->update_digits_work);
-    pr_info("device removed: %s\n", dev_name(dev));
-    kfree(dev_impl);
-}
-
-// digits attribute: the characters to show on the LEDs
+struct gpio_segled_device {
+    // Linux driver model base
+    struct device dev;
 
-static ssize_t digits_show(struct device* dev, struct device_attribute* attr, char* buf) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    return scnprintf(
-        buf, PAGE_SIZE,
-        "%c%s%c%s%c%s%c%s",
-        dev_impl->digits[0], dev_impl->decimal_points[0] ? "." : "",
-        dev_impl->digits[1], dev_impl->decimal_points[1] ? "." : "",
-        dev_impl->digits[2], dev_impl->decimal_points[2] ? "." : "",
-        dev_impl->digits[3], dev_impl->decimal_points[3] ? "." : ""
-    );
-}
+    // Number of digits, which is the number of digit GPIOs
+    // listed in the device tree.  The rows of a dot-matrix panel
+    // are scanned in the same way as digits, and so count as digits.
+    int num_digits;
 
-static ssize_t digits_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    int digit_in = 0;
-    int digit_out;
+    // Number of characters of text shown.  This is the number of digits
+    // for segmented panels, and as many characters of the font as fit
+    // across the columns for dot-matrix panels.
+    int num_chars;
 
-    // Initialize digits with all blanks.
-    for (digit_out = 0; digit_out < NUM_DIGITS; ++digit_out) {
-        dev_impl->digits[digit_out] = ' ';
-        dev_impl->decimal_points[digit_out] = 0;
-    }
+    // Number of slots in the scanning cycle of the panel.  This is the
+    // number of digits, except for color panels, which have one slot for
+    // each channel of each digit, and charlieplexed panels, which have
+    // one slot for each pin.
+    int num_slots;
 
-    // Read in characters one at at time, copying them to the digit
-    // buffer or setting decimal point flags as appropriate.
-    digit_out = 0;
-    for (digit_in = 0; digit_in < len; ++digit_in) {
-        // Stop early if a non-printable character is encountered
-        // or we run out of output digits.
-        if (
-            (buf[digit_in] < 32)
-            || (digit_out >= NUM_DIGITS)
-        ) {
-            break;
-        }
+    // Attributes
+    int brightness_percent;
 
-        // If the character is a decimal point, activate decimal point
-        // for the previous digit (if any).  Otherwise copy the character
-        // into the digit buffer.
-        if (
-            (buf[digit_in] == '.')
-            && (digit_out > 0)
-        ) {
-            dev_impl->decimal_points[digit_out - 1] = 1;
-        } else {
-            dev_impl->digits[digit_out++] = buf[digit_in];
-        }
-    }
+    // Conversion map of characters into segments, for segmented panels,
+    // guarded by the bus lock.
+    union gpio_segled_conversion_map map;
 
-    // If not all digits were populated, shift them to the right, padding
-    // the left with blanks.
-    if (digit_out < NUM_DIGITS) {
-        digit_in = digit_out - 1;
-        for (digit_out = NUM_DIGITS - 1; digit_out >= 0; --digit_out, --digit_in) {
-            if (digit_in >= 0) {
-                dev_impl->digits[digit_out] = dev_impl->digits[digit_in];
-                dev_impl->decimal_points[digit_out] = dev_impl->decimal_points[digit_in];
-            } else {
-                dev_impl->digits[digit_out] = ' ';
-                dev_impl->decimal_points[digit_out] = 0;
-            }
-        }
-    }
+    // Frames to show.  The shown frame is the one being scanned, and
+    // the staged frame, if commit_pending is set, replaces it at the
+    // start of the first scanning cycle at or after commit_at.  Both
+    // are guarded by the bus lock.
+    struct gpio_segled_frame frames[2];
+    struct gpio_segled_frame* shown;
+    struct gpio_segled_frame* staged;
+    int commit_pending;
+    ktime_t commit_at;
 
-    // Always return size of input buffer to prevent the user from doing
-    // something silly like trying to write for a second time.
-    return len;
-}
+    // seg-adjust - if set in the device tree, the design uses
+    // current limiters on the common anode/cathode pins, so we need
+    // to adjust duty cycles to match brightness across digits.
+    int seg_adjust;
 
-static DEVICE_ATTR_RW(digits);
+    // Device tree node describing the panel
+    struct fwnode_handle* fwnode;
 
-// refresh attribute: desired refresh rate of the device in Hertz
+    // For charlieplexed panels, the pins (numbered from 1, or 0 if
+    // there is no LED) of the anode and cathode of the LED of each
+    // segment of each digit, as listed in the device tree.
+    u32* charlieplex_leds;
 
-static ssize_t refresh_show(struct device* dev, struct device_attribute* attr, char* buf) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    return scnprintf(buf, PAGE_SIZE, "%lu", dev_impl->refresh_rate_hz);
-}
+    // Segment bus on which the panel is scanned
+    struct gpio_segled_bus* bus;
 
-static ssize_t refresh_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    (void)sscanf(buf, "%lu", &dev_impl->refresh_rate_hz);
-    return len;
-}
+    // Position of the first digit of the panel among the digits of its bus
+    int digit_base;
 
-static DEVICE_ATTR_RW(refresh);
+    // Optional PWM gating the digit commons of the panel, which then
+    // applies its brightness in hardware rather than through the length
+    // of each slot.
+    struct pwm_device* pwm;
 
-// brightness attribute: desired brightness in percent of maximum
+    // Character device ("/dev/segledN") through which frames may be
+    // written, and which reports each frame once it has been fully
+    // scanned out.  The number in its name is misc_id, or -1 until it
+    // is registered.  Once misc_gone is set, under misc_lock, the panel
+    // is going away and the device no longer touches its bus.
+    struct miscdevice misc;
+    char misc_name[16];
+    int misc_id;
+    struct mutex misc_lock;
+    int misc_gone;
 
-static ssize_t brightness_show(struct device* dev, struct device_attribute* attr, char* buf) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    return scnprintf(buf, PAGE_SIZE, "%d", dev_impl->brightness_percent);
-}
+    // How many frames have been fully scanned out, and when the latest
+    // of them was, guarded by shown_lock (taken inside the bus lock) so
+    // that they can be read without the bus.  frame_latched is set, with
+    // the bus lock held, while a newly latched frame is being scanned out
+    // for the first time.
+    spinlock_t shown_lock;
+    wait_queue_head_t shown_wait;
+    u64 frames_shown;
+    ktime_t shown_at;
+    int frame_latched;
 
-static ssize_t brightness_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
-    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
-    (void)sscanf(buf, "%d", &dev_impl->brightness_percent);
-    return len;
-}
+    // Frame shared with userspace by mapping the character device, once
+    // it has been mapped, and the sequence number of the frame last taken
+    // from it, both guarded by the bus lock.
+    struct segled_shared_frame* shared;
+    u32 shared_sequence;
 
-static DEVICE_ATTR_RW(brightness);
+    // Queue of frames to show one after another, each either at a given
+    // time (queue_times) or else for a duration in milliseconds after the
+    // frame before it, as bitmaps of segments worked out when they were
+    // queued (num_digits words for each frame).  queue_pos is the next
+    // frame to show, at its time if it has one, or else at queue_next_at
+    // if queue_active is set (while a queued frame with a duration is
+    // being shown), or else at the start of the next scanning cycle.  All
+    // guarded by the bus lock.
+    u32* queue_segments;
+    u32 queue_durations_ms[QUEUE_FRAMES];
+    ktime_t queue_times[QUEUE_FRAMES];
+    int queue_len;
+    int queue_pos;
+    int queue_loop;
+    int queue_active;
+    ktime_t queue_next_at;
+    u64 queue_underruns;
 
-// attribute groups
+    // Message shown through the "message" attribute, one character per
+    // digit, scrolling one character every scroll_step_ms if it is longer
+    // than the panel.  scroll_pos is the character of the message to show
+    // first in the next step, at scroll_next_at.  A message_len of zero
+    // means no message is shown.  All guarded by the bus lock.
+    char* message;
+    int message_len;
+    int scroll_pos;
+    unsigned int scroll_step_ms;
+    ktime_t scroll_next_at;
 
-static struct attribute* gpio_segled_attrs[] = {
-    &dev_attr_digits.attr,
-    &dev_attr_refresh.attr,
-    &dev_attr_brightness.attr,
-    NULL
-};
+    // Blinking and fading, worked out at the start of each scanning cycle
+    // into level_percent (the brightness the panel is lit at for the
+    // cycle), blink_off (set while the whole panel is blinked off) and
+    // digits_blinked_off (a bitmap of the digits blinked off).  Blinking
+    // is timed from blink_epoch.  A change of brightness fades from
+    // fade_from_percent, at fade_start, to fade_to_percent over fade_ms.
+    // All guarded by the bus lock.
+    struct gpio_segled_blink blink;
+    struct gpio_segled_blink digit_blink[MAX_DIGITS];
+    int digit_blink_set;
+    ktime_t blink_epoch;
+    int blink_off;
+    u32 digits_blinked_off;
+    unsigned int fade_ms;
+    int fade_from_percent;
+    int fade_to_percent;
+    ktime_t fade_start;
+    int level_percent;
 
-static const struct attribute_group gpio_segled_attr_group = {
-    .attrs = gpio_segled_attrs,
+    // Layers of text shown over the digits of the panel, the higher ones
+    // on top, and the time the next of them expires (or zero if none
+    // do).  All guarded by the bus lock.
+    struct gpio_segled_layer layers[NUM_LAYERS];
+    ktime_t layers_expire_at;
+};
+
+/**
+ * This is the state structure for a set of LED panels sharing the same
+ * segment GPIOs (a "segment bus").  The panels on a bus are scanned
+ * together as one group, one digit of one panel at a time, so that every
+ * digit on the bus gets an equal slot of the scanning cycle.  A panel with
+ * segment GPIOs of its own is the only panel on its bus.
+ */
+struct gpio_segled_bus {
+    // Attributes (shared by all panels on the bus)
+    unsigned long refresh_rate_hz;
+
+    // Internal state (non-attributes)
+    int resting;
+    int active_panel;
+    int active_digit;
+    int active_slot;
+    u32 segments_out;
+    u64 digits_out;
+    int duty_cycle_percent;
+    ktime_t cycle_start;
+    u64 cycle_ns;
+
+    // Frame sync (genlock) state, guarded by the lock since it is shared
+    // between the sync interrupt handler and the scanning timer.
+    enum gpio_segled_sync_mode sync_mode;
+    ktime_t sync_last_edge;
+    u64 sync_period_ns;
+    s64 sync_phase_error_ns;
+    int sync_edge_pending;
+    int sync_lock_count;
+    int sync_locked;
+
+    // Backend driving the LEDs, whether it was given in the device tree,
+    // and whether it may sleep.  Also the segments and digits it last lit,
+    // if known, and how many transfers lighting them have failed, retries
+    // included (readable through debugfs).
+    const struct segled_backend_ops* ops;
+    int ops_given;
+    int cansleep;
+    u32 segments_set;
+    u64 digits_set;
+    int outputs_valid;
+    u32 bus_errors;
+
+    // Kind of segmented LED devices on the bus, or NULL for dot-matrix
+    // panels, along with the number of segment (or column) GPIOs and
+    // their consumer identifiers.  Color panels have a full set of segment
+    // GPIOs for each of their channels.  A charlieplexed panel has a bus of its
+    // own, with its pins in place of segment GPIOs, driven high, driven
+    // low or left as inputs according to digits_out and segments_out.
+    const struct gpio_segled_segment_type* type;
+    int charlieplex;
+    int channels;
+    int num_gpios;
+    const char** consumers;
+
+    // For shift registers, the number of outputs shifted out for each slot
+    // (whole registers), and which of them are active-low.
+    int shift_bits;
+    u32 shift_invert;
+
+    // A panel driven by an HT16K33 controller also has a bus of its own,
+    // which the chip scans by itself.  The scanning timer then only goes
+    // off to latch staged frames, which are written out to the chip by the
+    // work item, along with any change in brightness or blinking rate.
+    struct i2c_client* controller;
+    int controller_frame_pending;
+    int controller_brightness;
+    int controller_blink_rate;
+
+    // A simulated panel also has a bus of its own, with no GPIOs at all,
+    // only a ring of records of the most recent slots of its scanning
+    // cycle, guarded by the lock, and a count of all slots recorded.
+    struct gpio_segled_record* records;
+    u64 num_records;
+
+    // Device tree references to the segment GPIOs, used to recognize
+    // panels sharing them.
+    struct fwnode_reference_args segment_refs[MAX_SEGMENT_GPIOS];
+
+    // Kernel resources.  The segment GPIOs are followed by the digit GPIOs
+    // of all the panels on the bus, so that all of them can be switched in
+    // one go.
+    struct gpio_desc* gpios[MAX_SEGMENT_GPIOS + MAX_BUS_DIGITS];
+    struct gpio_desc* sync_gpio;
+    struct gpio_desc* shift_data;
+    struct gpio_desc* shift_clock;
+    struct gpio_desc* shift_latch;
+    spinlock_t lock;
+    struct work_struct update_digits_work;
+    struct hrtimer digit_timer;
+
+    // Panels on the bus, in scanning order, and their total slot and
+    // digit counts.
+    int num_slots;
+    int num_digits;
+    int num_panels;
+    struct gpio_segled_device* panels[];
+};
+
+/**
+ * This is the state structure for a virtual display, which spans several
+ * LED panels and presents them as a single display.
+ */
+struct gpio_segled_virtual {
+    // Linux driver model base
+    struct device dev;
+
+    // Total number of characters of text, across all panels.
+    int num_chars;
+
+    // Panels making up the display, in order from left to right.
+    int num_panels;
+    struct gpio_segled_device* panels[];
+};
+
+/**
+ * This counts a frame of a panel as fully scanned out at the given time,
+ * waking up anybody waiting for it on the character device of the panel.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_frame_shown(struct gpio_segled_device* dev_impl, ktime_t now) {
+    spin_lock(&dev_impl->shown_lock);
+    ++dev_impl->frames_shown;
+    dev_impl->shown_at = now;
+    spin_unlock(&dev_impl->shown_lock);
+    wake_up_interruptible_all(&dev_impl->shown_wait);
+}
+
+static void gpio_segled_take_shared(struct gpio_segled_device* dev_impl);
+static void gpio_segled_take_queued(struct gpio_segled_device* dev_impl, ktime_t now);
+static void gpio_segled_scroll(struct gpio_segled_device* dev_impl, ktime_t now);
+static void gpio_segled_run_effects(struct gpio_segled_device* dev_impl, ktime_t now);
+static void gpio_segled_expire_layers(struct gpio_segled_device* dev_impl, ktime_t now);
+
+/**
+ * This latches the staged frame of a panel, making it the shown frame,
+ * along with any brightness, refresh rate and blinking given with it.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_latch(struct gpio_segled_device* dev_impl) {
+    struct gpio_segled_frame* frame;
+    int digit;
+
+    swap(dev_impl->shown, dev_impl->staged);
+    dev_impl->commit_pending = 0;
+    frame = dev_impl->shown;
+    if (frame->brightness_percent >= 0) {
+        dev_impl->brightness_percent = frame->brightness_percent;
+        frame->brightness_percent = -1;
+    }
+    if (frame->refresh_rate_hz) {
+        dev_impl->bus->refresh_rate_hz = frame->refresh_rate_hz;
+        frame->refresh_rate_hz = 0;
+    }
+
+    // New blinking starts on, for the panel and its digits together.
+    if (frame->blink_given) {
+        dev_impl->blink = frame->blink;
+        dev_impl->blink_epoch = ktime_get();
+        frame->blink_given = 0;
+    }
+    if (frame->digit_blink_given) {
+        memcpy(dev_impl->digit_blink, frame->digit_blink, dev_impl->num_digits * sizeof(*frame->digit_blink));
+        dev_impl->digit_blink_set = 0;
+        for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+            if (frame->digit_blink[digit].period_ms) {
+                dev_impl->digit_blink_set = 1;
+            }
+        }
+        dev_impl->blink_epoch = ktime_get();
+        frame->digit_blink_given = 0;
+    }
+}
+
+/**
+ * This function begins a new scanning cycle at the given time, latching
+ * any staged frame that is due and working out how long the cycle should
+ * last.  When following an external frame sync signal, the length is
+ * adjusted in order to pull the start of the next cycle into phase with
+ * the signal.
+ *
+ * It is called from prepare_update_digits, with the bus lock held.
+ */
+static void gpio_segled_start_cycle(struct gpio_segled_bus* bus, ktime_t now) {
+    struct gpio_segled_device* dev_impl;
+    u64 nominal_ns;
+    u64 timeout_ns;
+    u64 cycles_per_period;
+    u64 remainder_ns;
+    s64 since_edge_ns;
+    s64 phase_ns;
+    s64 correction_ns = 0;
+    int panel;
+
+    // Frames latched at the start of the cycle just ended have now been
+    // fully scanned out.  Take any new frames published through shared
+    // pages or due from frame queues, step scrolling messages, drop expired
+    // layers, latch the staged frames which are due, and work out blinking
+    // and fading for the cycle.  Allow for buses on slightly different
+    // clocks (for example, following separate sync signals) reaching the
+    // same cycle boundary a little early.
+    for (panel = 0; panel < bus->num_panels; ++panel) {
+        dev_impl = bus->panels[panel];
+        if (dev_impl->frame_latched) {
+            dev_impl->frame_latched = 0;
+            gpio_segled_frame_shown(dev_impl, now);
+        }
+        if (dev_impl->shared) {
+            gpio_segled_take_shared(dev_impl);
+        }
+        if (
+            dev_impl->queue_active
+            || (dev_impl->queue_pos < dev_impl->queue_len)
+        ) {
+            gpio_segled_take_queued(dev_impl, now);
+        }
+        if (
+            (dev_impl->message_len > dev_impl->num_chars)
+            && dev_impl->scroll_step_ms
+        ) {
+            gpio_segled_scroll(dev_impl, now);
+        }
+        if (
+            ktime_to_ns(dev_impl->layers_expire_at)
+            && segled_commit_due(ktime_to_ns(now), ktime_to_ns(dev_impl->layers_expire_at), bus->cycle_ns)
+        ) {
+            gpio_segled_expire_layers(dev_impl, now);
+        }
+        if (
+            dev_impl->commit_pending
+            && segled_commit_due(ktime_to_ns(now), ktime_to_ns(dev_impl->commit_at), bus->cycle_ns)
+        ) {
+            gpio_segled_latch(dev_impl);
+            dev_impl->frame_latched = 1;
+        }
+        gpio_segled_run_effects(dev_impl, now);
+    }
+
+    // Work out the length of the cycle only now, as a frame just latched
+    // may have changed the refresh rate.
+    nominal_ns = NSEC_PER_SEC / (bus->refresh_rate_hz ? bus->refresh_rate_hz : DEFAULT_REFRESH_RATE_HZ);
+    timeout_ns = max(bus->sync_period_ns, nominal_ns) * SYNC_TIMEOUT_PERIODS;
+
+    bus->cycle_start = now;
+    bus->cycle_ns = nominal_ns;
+
+    // Free-run if not synchronizing, if no sync edge has been seen yet,
+    // or if the sync signal has gone quiet.
+    since_edge_ns = ktime_to_ns(ktime_sub(now, bus->sync_last_edge));
+    if (
+        (bus->sync_mode == SEGLED_SYNC_NONE)
+        || !ktime_to_ns(bus->sync_last_edge)
+        || (since_edge_ns > (s64)timeout_ns)
+    ) {
+        bus->sync_edge_pending = 0;
+        bus->sync_lock_count = 0;
+        bus->sync_locked = 0;
+        return;
+    }
+
+    // When phase-locking, fit a whole number of cycles (as close to the
+    // configured refresh rate as possible) into each sync period.
+    if (
+        (bus->sync_mode == SEGLED_SYNC_PLL)
+        && bus->sync_period_ns
+    ) {
+        cycles_per_period = max_t(u64, 1, DIV_ROUND_CLOSEST_ULL(bus->sync_period_ns, nominal_ns));
+        nominal_ns = div64_u64(bus->sync_period_ns, cycles_per_period);
+    }
+
+    // Measure how far this cycle starts from the nearest cycle boundary
+    // implied by the last sync edge.  Positive means the cycle is late.
+    (void)div64_u64_rem(abs(since_edge_ns), nominal_ns, &remainder_ns);
+    phase_ns = (since_edge_ns < 0) ? -(s64)remainder_ns : (s64)remainder_ns;
+    if (phase_ns > (s64)(nominal_ns / 2)) {
+        phase_ns -= nominal_ns;
+    } else if (phase_ns < -(s64)(nominal_ns / 2)) {
+        phase_ns += nominal_ns;
+    }
+    bus->sync_phase_error_ns = phase_ns;
+
+    // Consider the bus locked once enough consecutive cycles
+    // start within the lock window.
+    if (abs(phase_ns) <= (s64)(nominal_ns / SYNC_LOCK_DIVISOR)) {
+        if (bus->sync_lock_count < SYNC_LOCK_CYCLES) {
+            ++bus->sync_lock_count;
+        }
+    } else {
+        bus->sync_lock_count = 0;
+    }
+    bus->sync_locked = (bus->sync_lock_count >= SYNC_LOCK_CYCLES);
+
+    // Shorten or lengthen this cycle to pull the next one into phase,
+    // either gradually (PLL) or all at once after each edge (rephase).
+    if (bus->sync_mode == SEGLED_SYNC_PLL) {
+        correction_ns = div_s64(phase_ns, SYNC_PLL_GAIN);
+    } else if (bus->sync_edge_pending) {
+        correction_ns = phase_ns;
+    }
+    bus->sync_edge_pending = 0;
+    bus->cycle_ns = nominal_ns - correction_ns;
+}
+
+/**
+ * This gives the share of each slot a panel is lit for, before any
+ * adjustment for colors or segments lit, allowing for blinking and fading.
+ * Panels whose digit commons are gated by a PWM are lit for whole slots
+ * (unless blinked off), leaving their brightness to the PWM, so that the
+ * scanning timer only ticks once per slot.
+ */
+static int gpio_segled_slot_brightness(struct gpio_segled_device* dev_impl) {
+    if (dev_impl->blink_off) {
+        return 0;
+    }
+    return dev_impl->pwm ? 100 : dev_impl->level_percent;
+}
+
+/**
+ * This function sets up the bus state in preparation for driving
+ * the digit and segments that are next in the scanning cycle.
+ *
+ * It is called directly from the scanning timer callback, with the
+ * bus lock held.
+ */
+static void prepare_update_digits(struct gpio_segled_bus* bus, ktime_t now) {
+    struct gpio_segled_device* dev_impl;
+    int digit, channel, segments;
+
+    // If the active digit was shown for less than its full slot,
+    // rest (all digits off) for the remainder of the slot.
+    if (
+        !bus->resting
+        && (bus->duty_cycle_percent > 0)
+        && (bus->duty_cycle_percent < 100)
+    ) {
+        bus->resting = 1;
+        return;
+    }
+
+    // Advance to next digit, moving on to the next panel after the last
+    // digit of each panel, and returning to the first digit of the first
+    // panel at the end, starting a new scanning cycle.
+    ++bus->active_slot;
+    if (++bus->active_digit >= bus->panels[bus->active_panel]->num_slots) {
+        bus->active_digit = 0;
+        if (++bus->active_panel >= bus->num_panels) {
+            bus->active_panel = 0;
+            bus->active_slot = 0;
+            gpio_segled_start_cycle(bus, now);
+        }
+    }
+    dev_impl = bus->panels[bus->active_panel];
+
+    // Charlieplexed panels follow the plan worked out when the frame was
+    // staged, resting through any slots it leaves empty.
+    if (bus->charlieplex) {
+        bus->digits_out = dev_impl->shown->plan_high[bus->active_digit];
+        bus->segments_out = dev_impl->shown->plan_low[bus->active_digit];
+        bus->duty_cycle_percent = bus->digits_out ? gpio_segled_slot_brightness(dev_impl) : 0;
+        bus->resting = (bus->duty_cycle_percent <= 0);
+        return;
+    }
+
+    // Color panels show each channel of a digit in a slot of its own.
+    digit = bus->active_digit / bus->channels;
+    channel = bus->active_digit % bus->channels;
+    bus->digits_out = BIT_ULL(dev_impl->digit_base + digit);
+
+    // Save GPIO selection bitmap, worked out when the frame was staged,
+    // for use when GPIOs are actually switched by the backend.
+    bus->segments_out = dev_impl->shown->segments[digit];
+
+    // Compute duty cycle as follows:
+    // 1. Start with brightness setting of the panel (as faded), unless it
+    //    is applied by a PWM gating the digit commons instead, scaled by
+    //    the brightness of the digit, or nothing if it is blinked off.
+    // 2. For color panels, factor in the level of the channel, leaving
+    //    empty channels dark so that no GPIOs are switched for them.
+    // 3. Factor in number of segments lit, if seg-adjust was set
+    //    in device tree.
+    if (dev_impl->digits_blinked_off & BIT(digit)) {
+        bus->duty_cycle_percent = 0;
+    } else {
+        bus->duty_cycle_percent = gpio_segled_slot_brightness(dev_impl) * dev_impl->shown->digit_brightness[digit] / 100;
+    }
+    if (bus->channels > 1) {
+        segments = bus->num_gpios / bus->channels;
+        bus->segments_out &= (BIT(segments) - 1) << (channel * segments);
+        bus->duty_cycle_percent = bus->duty_cycle_percent * gpio_segled_color_level(dev_impl->shown->colors[digit], channel) / 255;
+        if (!bus->segments_out) {
+            bus->duty_cycle_percent = 0;
+        }
+    }
+    if (dev_impl->seg_adjust) {
+        bus->duty_cycle_percent = segled_adjust_duty(bus->duty_cycle_percent, bus->segments_out, bus->channels, bus->num_gpios);
+    }
+
+    // A digit with no duty cycle at all rests for its entire slot.
+    bus->resting = (bus->duty_cycle_percent <= 0);
+}
+
+/**
+ * This puts a bus at the end of its scanning cycle, so that the next
+ * tick of the scanning timer starts a new cycle.
+ */
+static void gpio_segled_bus_rewind(struct gpio_segled_bus* bus) {
+    bus->active_panel = bus->num_panels - 1;
+    bus->active_digit = bus->panels[bus->active_panel]->num_slots - 1;
+    bus->active_slot = bus->num_slots - 1;
+    bus->resting = 1;
+}
+
+/**
+ * These switch one GPIO of a bus, or several in one go, from the scanning
+ * timer callback if the backend of the bus doesn't sleep, or from the work
+ * item if it does.
+ */
+static void gpio_segled_set_value(struct gpio_segled_bus* bus, struct gpio_desc* desc, int value) {
+    if (bus->cansleep) {
+        gpiod_set_value_cansleep(desc, value);
+    } else {
+        gpiod_set_value(desc, value);
+    }
+}
+
+static int gpio_segled_set_array(struct gpio_segled_bus* bus, int count, struct gpio_desc** descs, unsigned long* values) {
+    if (bus->cansleep) {
+        return gpiod_set_array_value_cansleep(count, descs, NULL, values);
+    }
+    return gpiod_set_array_value(count, descs, NULL, values);
+}
+
+/**
+ * This tells whether any of the segment and digit GPIOs of a bus sleep
+ * (as do those on I2C or SPI expander chips).
+ */
+static int gpio_segled_gpio_cansleep(struct gpio_segled_bus* bus) {
+    int gpio;
+
+    for (gpio = 0; gpio < bus->num_gpios + bus->num_digits; ++gpio) {
+        if (gpiod_cansleep(bus->gpios[gpio])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This turns off all the LEDs of a bus when the driver is unloaded.
+ */
+static void gpio_segled_darken(struct gpio_segled_bus* bus) {
+    if (bus->num_panels) {
+        bus->ops->apply(bus, 0, 0);
+    }
+}
+
+/**
+ * This is the apply operation of the "gpio" backend, which switches the
+ * digit GPIOs one at a time, turning off the digits to be turned off before
+ * changing the segments, and only then turning on the digits to be turned
+ * on, so that no digit ever shows the segments of another, even when the
+ * GPIOs are on different chips.
+ */
+static void gpio_segled_gpio_apply(struct gpio_segled_bus* bus, u32 segments, u64 digits) {
+    unsigned long values = segments;
+    int digit;
+
+    for (digit = 0; digit < bus->num_digits; ++digit) {
+        if (bus->digits_set & ~digits & BIT_ULL(digit)) {
+            gpio_segled_set_value(bus, bus->gpios[bus->num_gpios + digit], 0);
+        }
+    }
+    if (segments != bus->segments_set) {
+        (void)gpio_segled_set_array(bus, bus->num_gpios, bus->gpios, &values);
+        bus->segments_set = segments;
+    }
+    for (digit = 0; digit < bus->num_digits; ++digit) {
+        if (digits & ~bus->digits_set & BIT_ULL(digit)) {
+            gpio_segled_set_value(bus, bus->gpios[bus->num_gpios + digit], 1);
+        }
+    }
+    bus->digits_set = digits;
+}
+
+/**
+ * This is the apply operation of the "gpio-array" backend, which switches
+ * all the segment and digit GPIOs of a bus in one go, turning off the last
+ * digit lit and lighting the next one at the same time as the segments are
+ * changed, so that a bus with all its GPIOs on one expander chip takes a
+ * single transfer (or one for each port) for each slot.  Nothing is sent
+ * if nothing is to change.  A failed transfer is tried again, up to
+ * BUS_RETRIES more times, and each failure is counted.  If they all fail,
+ * the state of the GPIOs is unknown, so they are all sent again for the
+ * next slot.
+ */
+static void gpio_segled_gpio_array_apply(struct gpio_segled_bus* bus, u32 segments, u64 digits) {
+    DECLARE_BITMAP(values, MAX_SEGMENT_GPIOS + MAX_BUS_DIGITS);
+    int digit, retries, ret;
+
+    if (
+        bus->outputs_valid
+        && (segments == bus->segments_set)
+        && (digits == bus->digits_set)
+    ) {
+        return;
+    }
+    bitmap_zero(values, MAX_SEGMENT_GPIOS + MAX_BUS_DIGITS);
+    values[0] = segments;
+    for (digit = 0; digit < bus->num_digits; ++digit) {
+        if (digits & BIT_ULL(digit)) {
+            __set_bit(bus->num_gpios + digit, values);
+        }
+    }
+    for (retries = 0; ; ++retries) {
+        ret = gpio_segled_set_array(bus, bus->num_gpios + bus->num_digits, bus->gpios, values);
+        if (!ret) {
+            break;
+        }
+        ++bus->bus_errors;
+        if (retries == BUS_RETRIES) {
+            bus->outputs_valid = 0;
+            pr_err_ratelimited("unable to set GPIOs: error code %d (%u errors)\n", ret, bus->bus_errors);
+            return;
+        }
+    }
+    bus->segments_set = segments;
+    bus->digits_set = digits;
+    bus->outputs_valid = 1;
+}
+
+/**
+ * This is the apply operation of the "charlieplex" backend, which switches
+ * the pins of a charlieplexed panel to drive the given pins high and low,
+ * leaving the rest as inputs.  Only pins that change are touched, and pins
+ * are released before any are driven, so that no LED outside of either
+ * slot is ever lit in passing.
+ */
+static void gpio_segled_charlieplex_apply(struct gpio_segled_bus* bus, u32 lows, u64 highs) {
+    u32 released = (bus->digits_set & ~highs) | (bus->segments_set & ~lows);
+    u32 new_lows = lows & ~bus->segments_set;
+    u32 new_highs = highs & ~bus->digits_set;
+    int pin;
+
+    for (pin = 0; pin < bus->num_gpios; ++pin) {
+        if (released & BIT(pin)) {
+            (void)gpiod_direction_input(bus->gpios[pin]);
+        }
+    }
+    for (pin = 0; pin < bus->num_gpios; ++pin) {
+        if (new_lows & BIT(pin)) {
+            (void)gpiod_direction_output(bus->gpios[pin], 0);
+        }
+    }
+    for (pin = 0; pin < bus->num_gpios; ++pin) {
+        if (new_highs & BIT(pin)) {
+            (void)gpiod_direction_output(bus->gpios[pin], 1);
+        }
+    }
+    bus->digits_set = highs;
+    bus->segments_set = lows;
+}
+
+/**
+ * This is the cansleep operation of the "charlieplex" backend.  Changing
+ * the direction of a GPIO may always sleep.
+ */
+static int gpio_segled_charlieplex_cansleep(struct gpio_segled_bus* bus) {
+    return 1;
+}
+
+/**
+ * This shifts the given outputs into a panel's chain of shift registers,
+ * last output first, and then latches them all onto the outputs at once,
+ * so that the outputs never show the word partly shifted in.
+ */
+static void gpio_segled_shift_out(struct gpio_segled_bus* bus, u32 outputs) {
+    int bit;
+
+    for (bit = bus->shift_bits - 1; bit >= 0; --bit) {
+        gpio_segled_set_value(bus, bus->shift_data, (outputs >> bit) & 1);
+        gpio_segled_set_value(bus, bus->shift_clock, 1);
+        gpio_segled_set_value(bus, bus->shift_clock, 0);
+    }
+    gpio_segled_set_value(bus, bus->shift_latch, 1);
+    gpio_segled_set_value(bus, bus->shift_latch, 0);
+}
+
+/**
+ * This is the apply operation of the "shift-register" backend, which
+ * shifts out the segments together with the digit commons after them,
+ * unless they are already shifted out.
+ */
+static void gpio_segled_shift_register_apply(struct gpio_segled_bus* bus, u32 segments, u64 digits) {
+    if (
+        bus->outputs_valid
+        && (segments == bus->segments_set)
+        && (digits == bus->digits_set)
+    ) {
+        return;
+    }
+    gpio_segled_shift_out(bus, (segments | ((u32)digits << bus->num_gpios)) ^ bus->shift_invert);
+    bus->segments_set = segments;
+    bus->digits_set = digits;
+    bus->outputs_valid = 1;
+}
+
+/**
+ * This is the cansleep operation of the "shift-register" backend.
+ */
+static int gpio_segled_shift_register_cansleep(struct gpio_segled_bus* bus) {
+    return (
+        gpiod_cansleep(bus->shift_data)
+        || gpiod_cansleep(bus->shift_clock)
+        || gpiod_cansleep(bus->shift_latch)
+    );
+}
+
+/**
+ * This gives the blinking rate of an HT16K33 controller whose period is
+ * nearest the given one, in milliseconds (zero for not blinking).
+ */
+static int gpio_segled_controller_blink_rate(unsigned int period_ms) {
+    int rate;
+
+    if (!period_ms) {
+        return 0;
+    }
+    for (rate = 1; rate < ARRAY_SIZE(gpio_segled_controller_blink_periods_ms) - 1; ++rate) {
+        if (period_ms < (gpio_segled_controller_blink_periods_ms[rate] + gpio_segled_controller_blink_periods_ms[rate + 1]) / 2) {
+            break;
+        }
+    }
+    return rate;
+}
+
+/**
+ * This is the update operation of the "ht16k33" backend, which writes the
+ * shown frame of a panel driven by an HT16K33 controller out to the display
+ * RAM of the chip, all in one go, if it has changed, followed by the
+ * brightness and blinking rate of the panel, if either has changed.  The
+ * brightness maps onto the sixteen dimming levels of the chip, with the
+ * display turned off altogether at zero.
+ */
+static void gpio_segled_controller_update(struct gpio_segled_bus* bus) {
+    struct gpio_segled_device* dev_impl = bus->panels[0];
+    u8 ram[HT16K33_RAM_SIZE] = {0};
+    unsigned long flags;
+    int frame_pending, brightness_percent, blink_rate, digit, ret;
+
+    spin_lock_irqsave(&bus->lock, flags);
+    frame_pending = bus->controller_frame_pending;
+    bus->controller_frame_pending = 0;
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        ram[digit * 2] = dev_impl->shown->segments[digit] & 0xff;
+        ram[digit * 2 + 1] = (dev_impl->shown->segments[digit] >> 8) & 0xff;
+    }
+    brightness_percent = clamp(dev_impl->brightness_percent, 0, 100);
+    blink_rate = gpio_segled_controller_blink_rate(dev_impl->blink.period_ms);
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    // The chip shows a frame as soon as it has been written to it.
+    if (frame_pending) {
+        ret = i2c_smbus_write_i2c_block_data(bus->controller, HT16K33_CMD_RAM, sizeof(ram), ram);
+        if (ret < 0) {
+            pr_err("unable to write HT16K33 display RAM: error code %d\n", ret);
+        } else {
+            spin_lock_irqsave(&bus->lock, flags);
+            gpio_segled_frame_shown(dev_impl, ktime_get());
+            spin_unlock_irqrestore(&bus->lock, flags);
+        }
+    }
+    if (
+        (brightness_percent != bus->controller_brightness)
+        || (blink_rate != bus->controller_blink_rate)
+    ) {
+        if (brightness_percent) {
+            ret = i2c_smbus_write_byte(bus->controller, HT16K33_CMD_DIMMING | (DIV_ROUND_UP(brightness_percent * HT16K33_DIMMING_LEVELS, 100) - 1));
+            if (!ret) {
+                ret = i2c_smbus_write_byte(bus->controller, HT16K33_CMD_DISPLAY | HT16K33_ON | (blink_rate << HT16K33_BLINK_SHIFT));
+            }
+        } else {
+            ret = i2c_smbus_write_byte(bus->controller, HT16K33_CMD_DISPLAY);
+        }
+        if (ret < 0) {
+            pr_err("unable to set HT16K33 brightness: error code %d\n", ret);
+        } else {
+            bus->controller_brightness = brightness_percent;
+            bus->controller_blink_rate = blink_rate;
+        }
+    }
+}
+
+/**
+ * This is the cansleep operation of the "ht16k33" backend.  Writing to
+ * the chip always sleeps.
+ */
+static int gpio_segled_controller_cansleep(struct gpio_segled_bus* bus) {
+    return 1;
+}
+
+/**
+ * This is the release operation of the "ht16k33" backend, which turns off
+ * and lets go of the controller.
+ */
+static void gpio_segled_controller_release(struct gpio_segled_bus* bus) {
+    struct i2c_adapter* adapter;
+
+    if (!bus->controller) {
+        return;
+    }
+    adapter = bus->controller->adapter;
+    (void)i2c_smbus_write_byte(bus->controller, HT16K33_CMD_DISPLAY);
+    i2c_unregister_device(bus->controller);
+    i2c_put_adapter(adapter);
+    bus->controller = NULL;
+}
+
+/**
+ * This is the apply operation of the "simulated" backend, which records
+ * the slot rather than switching any GPIOs.
+ */
+static void gpio_segled_simulated_apply(struct gpio_segled_bus* bus, u32 segments, u64 digits) {
+    struct gpio_segled_record* record;
+    unsigned long flags;
+
+    spin_lock_irqsave(&bus->lock, flags);
+    record = &bus->records[bus->num_records++ % SIMULATED_RECORDS];
+    record->time = ktime_get();
+    record->digit = digits ? __ffs64(digits) : -1;
+    record->segments = digits ? segments : 0;
+    spin_unlock_irqrestore(&bus->lock, flags);
+}
+
+/**
+ * This is the cansleep operation of the "simulated" backend.
+ */
+static int gpio_segled_simulated_cansleep(struct gpio_segled_bus* bus) {
+    return 0;
+}
+
+/**
+ * This has the backend of a bus light the digits and segments that are
+ * next in the scanning cycle, leaving the segments as they are while
+ * resting.
+ *
+ * It is called from the scanning timer callback, or from a kernel worker
+ * process scheduled from it if the backend may sleep.
+ */
+static void gpio_segled_bus_apply(struct gpio_segled_bus* bus) {
+    unsigned long flags;
+    u32 segments_out;
+    u64 digits_out;
+    int resting;
+
+    // Take a consistent snapshot of what the scanning timer set up.
+    spin_lock_irqsave(&bus->lock, flags);
+    segments_out = bus->segments_out;
+    digits_out = bus->digits_out;
+    resting = bus->resting;
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    if (resting) {
+        bus->ops->apply(bus, bus->segments_set, 0);
+    } else {
+        bus->ops->apply(bus, segments_out, digits_out);
+    }
+}
+
+/**
+ * This is the scanning timer callback for a bus whose backend does its
+ * own scanning.  The timer then only goes off when a staged frame is due,
+ * to latch it and schedule the work item to write it out.
+ */
+static enum hrtimer_restart gpio_segled_commit_tick(struct gpio_segled_bus* bus) {
+    struct gpio_segled_device* dev_impl = bus->panels[0];
+    enum hrtimer_restart restart = HRTIMER_NORESTART;
+    unsigned long flags;
+
+    spin_lock_irqsave(&bus->lock, flags);
+    if (dev_impl->commit_pending) {
+        if (ktime_before(ktime_get(), dev_impl->commit_at)) {
+            hrtimer_set_expires(&bus->digit_timer, dev_impl->commit_at);
+            restart = HRTIMER_RESTART;
+        } else {
+            gpio_segled_latch(dev_impl);
+            bus->controller_frame_pending = 1;
+        }
+    }
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    (void)schedule_work(&bus->update_digits_work);
+    return restart;
+}
+
+/**
+ * This function has the backend of a bus catch up with the scanning cycle,
+ * or with the latest frame for backends which do their own scanning.
+ *
+ * It is called from a kernel worker process scheduled from the scanning
+ * timer callback.
+ */
+static void execute_update_digits(struct work_struct* work) {
+    struct gpio_segled_bus* bus = container_of(work, struct gpio_segled_bus, update_digits_work);
+
+    if (bus->ops->update) {
+        bus->ops->update(bus);
+    } else {
+        gpio_segled_bus_apply(bus);
+    }
+}
+
+/**
+ * This is the callback for the scanning timer.  It updates the bus state
+ * to reflect the next digit and segments to be driven, and has the backend
+ * of the bus switch its outputs to match.
+ *
+ * The timer expiration is updated according to the proper duty cycle
+ * configured for the current digit.  Each digit is given an equal slot
+ * of the scanning cycle, measured from the start of the cycle so that
+ * rounding never accumulates from one cycle to the next.
+ */
+static enum hrtimer_restart gpio_segled_digit_timer_tick(struct hrtimer* data) {
+    struct gpio_segled_bus* bus = container_of(data, struct gpio_segled_bus, digit_timer);
+    ktime_t now = hrtimer_get_expires(&bus->digit_timer);
+    ktime_t slot_start, slot_end, expires;
+    unsigned long flags;
+
+    if (bus->ops->update) {
+        return gpio_segled_commit_tick(bus);
+    }
+
+    spin_lock_irqsave(&bus->lock, flags);
+
+    // Advance bus state one step in the scanning cycle.
+    prepare_update_digits(bus, now);
+
+    // Calculate next timer expiration based on duty cycle and whether or
+    // not we're currently resting.
+    slot_start = ktime_add_ns(bus->cycle_start, segled_slot_offset_ns(bus->cycle_ns, bus->active_slot, bus->num_slots));
+    slot_end = ktime_add_ns(bus->cycle_start, segled_slot_offset_ns(bus->cycle_ns, bus->active_slot + 1, bus->num_slots));
+    expires = slot_end;
+    if (
+        !bus->resting
+        && (bus->duty_cycle_percent < 100)
+    ) {
+        expires = ktime_add_ns(slot_start, segled_slot_on_ns(ktime_to_ns(ktime_sub(slot_end, slot_start)), bus->duty_cycle_percent));
+    }
+
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    // Switch the outputs right away if the backend can do so without
+    // sleeping, or else schedule a work item to switch them.
+    if (bus->cansleep) {
+        (void)schedule_work(&bus->update_digits_work);
+    } else {
+        gpio_segled_bus_apply(bus);
+    }
+
+    // Update the timer to tick again when the current step is over.
+    hrtimer_set_expires(&bus->digit_timer, expires);
+    return HRTIMER_RESTART;
+}
+
+/**
+ * This is the handler for edges on the external frame sync signal.
+ * It only timestamps the edge and estimates the period of the signal;
+ * the scanning timer takes care of following it at the start of
+ * each scanning cycle.
+ */
+static irqreturn_t gpio_segled_sync_irq(int irq, void* data) {
+    struct gpio_segled_bus* bus = data;
+    ktime_t now = ktime_get();
+    unsigned long flags;
+    u64 period_ns;
+
+    spin_lock_irqsave(&bus->lock, flags);
+    if (ktime_to_ns(bus->sync_last_edge)) {
+        // Smooth the period estimate, throwing out intervals that are
+        // obviously the result of missed or spurious edges.
+        period_ns = ktime_to_ns(ktime_sub(now, bus->sync_last_edge));
+        if (!bus->sync_period_ns) {
+            bus->sync_period_ns = period_ns;
+        } else if (
+            (period_ns > bus->sync_period_ns / 2)
+            && (period_ns < bus->sync_period_ns * 3 / 2)
+        ) {
+            bus->sync_period_ns = bus->sync_period_ns - (bus->sync_period_ns >> 3) + (period_ns >> 3);
+        }
+    }
+    bus->sync_last_edge = now;
+    bus->sync_edge_pending = 1;
+    spin_unlock_irqrestore(&bus->lock, flags);
+    return IRQ_HANDLED;
+}
+
+/**
+ * This frees the memory held for the state of a single LED panel.
+ */
+static void gpio_segled_device_free(struct gpio_segled_device* dev_impl) {
+    int frame;
+    for (frame = 0; frame < ARRAY_SIZE(dev_impl->frames); ++frame) {
+        kfree(dev_impl->frames[frame].plan_low);
+        kfree(dev_impl->frames[frame].plan_high);
+        kfree(dev_impl->frames[frame].segments);
+        kfree(dev_impl->frames[frame].colors);
+        kfree(dev_impl->frames[frame].digit_brightness);
+        kfree(dev_impl->frames[frame].digit_blink);
+        kfree(dev_impl->frames[frame].decimal_points);
+        kfree(dev_impl->frames[frame].digits);
+    }
+    kfree(dev_impl->charlieplex_leds);
+    free_page((unsigned long)dev_impl->shared);
+    kfree(dev_impl->queue_segments);
+    kfree(dev_impl->message);
+    kfree(dev_impl);
+}
+
+/**
+ * This is called by the kernel whenever a device is removed.
+ */
+static void gpio_segled_device_release(struct device* dev) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    pr_info("device removed: %s\n", dev_name(dev));
+    gpio_segled_device_free(dev_impl);
+}
+
+/**
+ * This sets the duty cycle of the PWM gating the digit commons of a panel
+ * to match its brightness, or turns the PWM off.  It may sleep.
+ */
+static void gpio_segled_apply_pwm(struct gpio_segled_device* dev_impl, int enabled) {
+    struct pwm_state state;
+    int ret;
+
+    pwm_init_state(dev_impl->pwm, &state);
+    ret = pwm_set_relative_duty_cycle(&state, clamp(dev_impl->brightness_percent, 0, 100), 100);
+    if (!ret) {
+        state.enabled = enabled;
+        ret = pwm_apply_might_sleep(dev_impl->pwm, &state);
+    }
+    if (ret) {
+        pr_err("unable to set %s PWM: error code %d\n", dev_name(&dev_impl->dev), ret);
+    }
+}
+
+/**
+ * This stops scanning a bus, ahead of its panels being freed, and has
+ * its backend turn off its LEDs and let go of what it holds.  The devices
+ * of its panels, and of any virtual displays using them, must already
+ * have been deleted, so that no attribute can start scanning it again.
+ */
+static void gpio_segled_bus_stop(struct gpio_segled_bus* bus) {
+    int panel;
+
+    (void)hrtimer_cancel(&bus->digit_timer);
+    (void)cancel_work_sync(&bus->update_digits_work);
+    if (bus->ops->release) {
+        bus->ops->release(bus);
+    }
+    for (panel = 0; panel < bus->num_panels; ++panel) {
+        if (bus->panels[panel]->pwm) {
+            gpio_segled_apply_pwm(bus->panels[panel], 0);
+        }
+    }
+}
+
+/**
+ * This lists the most recent slots recorded for a simulated panel, oldest
+ * first, after the number of slots recorded in all, one line per slot
+ * giving the time in nanoseconds, the digit (or -1 if resting) and the
+ * segments.
+ */
+static int gpio_segled_records_show(struct seq_file* s, void* data) {
+    struct gpio_segled_bus* bus = s->private;
+    struct gpio_segled_record* records;
+    unsigned long flags;
+    u64 num_records;
+    int count, index;
+
+    // Copy the records out first, so as not to hold up scanning
+    // while they are formatted.
+    records = kmalloc_array(SIMULATED_RECORDS, sizeof(*records), GFP_KERNEL);
+    if (!records) {
+        return -ENOMEM;
+    }
+    spin_lock_irqsave(&bus->lock, flags);
+    memcpy(records, bus->records, SIMULATED_RECORDS * sizeof(*records));
+    num_records = bus->num_records;
+    spin_unlock_irqrestore(&bus->lock, flags);
+
+    seq_printf(s, "%llu\n", num_records);
+    count = min_t(u64, num_records, SIMULATED_RECORDS);
+    for (index = 0; index < count; ++index) {
+        const struct gpio_segled_record* record = &records[(num_records - count + index) % SIMULATED_RECORDS];
+        seq_printf(s, "%lld %d %08x\n", ktime_to_ns(record->time), record->digit, record->segments);
+    }
+    kfree(records);
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(gpio_segled_records);
+
+/**
+ * This formats the characters shown on a display, in the format accepted
+ * by the "digits" attribute, appending them to the given buffer.
+ */
+static ssize_t gpio_segled_format_digits(char* buf, ssize_t len, int num_digits, const char* digits, const int* decimal_points) {
+    int digit;
+    for (digit = 0; digit < num_digits; ++digit) {
+        len += scnprintf(
+            buf + len, PAGE_SIZE - len,
+            "%c%s",
+            digits[digit], decimal_points[digit] ? "." : ""
+        );
+    }
+    return len;
+}
+
+/**
+ * This converts a character to display, along with its decimal point,
+ * into a bitmap selecting the segment GPIOs to switch on.
+ */
+static u32 gpio_segled_map_digit(const struct gpio_segled_segment_type* type, union gpio_segled_conversion_map* map, char digit, int decimal_point) {
+    int segments = type->map(map, (unsigned char)digit);
+    u32 segments_out = (segments < 0) ? 0 : segments;
+    if (decimal_point) {
+        segments_out |= BIT(type->segments);
+    }
+    return segments_out;
+}
+
+/**
+ * This draws text on a dot-matrix panel using the 5x7 font, one character
+ * after another from the left, with a blank column between characters.
+ * Decimal points are not shown.
+ */
+static void gpio_segled_render_text(struct gpio_segled_device* dev_impl, struct gpio_segled_frame* frame, const char* digits) {
+    const u8* glyph;
+    int chr, column, x, row;
+
+    memset(frame->segments, 0, dev_impl->num_digits * sizeof(*frame->segments));
+    for (chr = 0; chr < dev_impl->num_chars; ++chr) {
+        if (
+            (digits[chr] < FONT_5X7_FIRST)
+            || (digits[chr] > FONT_5X7_LAST)
+        ) {
+            continue;
+        }
+        glyph = font_5x7[digits[chr] - FONT_5X7_FIRST];
+        for (column = 0; column < FONT_5X7_WIDTH; ++column) {
+            x = chr * (FONT_5X7_WIDTH + 1) + column;
+            if (x >= dev_impl->bus->num_gpios) {
+                break;
+            }
+            for (row = 0; row < min(dev_impl->num_digits, FONT_5X7_HEIGHT); ++row) {
+                if (glyph[column] & BIT(row)) {
+                    frame->segments[row] |= BIT(x);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * This merges groups of charlieplexed LEDs sharing a pin (the "common"
+ * pin of the group) into as few slots as possible.  Groups whose other
+ * ("partner") pins are exactly the same are lit together, by driving all
+ * their common pins at once.  It returns the number of slots needed.
+ */
+static int gpio_segled_charlieplex_merge(const u32* groups, int num_pins, u32* commons, u32* partners) {
+    int pin, slot, num_slots = 0;
+
+    for (pin = 0; pin < num_pins; ++pin) {
+        if (!groups[pin]) {
+            continue;
+        }
+        for (slot = 0; slot < num_slots; ++slot) {
+            if (partners[slot] == groups[pin]) {
+                break;
+            }
+        }
+        if (slot == num_slots) {
+            partners[num_slots] = groups[pin];
+            commons[num_slots++] = 0;
+        }
+        commons[slot] |= BIT(pin);
+    }
+    return num_slots;
+}
+
+/**
+ * This works out which pins of a charlieplexed panel to drive high and
+ * low in each slot of the scanning cycle in order to light the segments
+ * of a frame.  The LEDs lit in a slot are those with their anode on a pin
+ * driven high and their cathode on a pin driven low, so the LEDs are
+ * grouped either by anode or by cathode, whichever takes fewer slots.
+ * Slots left over are empty.  The number of slots is always the number of
+ * pins, so that brightness doesn't depend on what is shown.
+ */
+static void gpio_segled_plan_charlieplex(struct gpio_segled_device* dev_impl, struct gpio_segled_frame* frame) {
+    int num_pins = dev_impl->bus->num_gpios;
+    int segments = dev_impl->bus->type->num_gpios;
+    u32 by_anode[MAX_SEGMENT_GPIOS] = {0};
+    u32 by_cathode[MAX_SEGMENT_GPIOS] = {0};
+    u32 cathode_high[MAX_SEGMENT_GPIOS];
+    u32 cathode_low[MAX_SEGMENT_GPIOS];
+    int digit, segment, anode, cathode, anode_slots, cathode_slots;
+
+    // Collect the LEDs to light, by anode and by cathode.
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        for (segment = 0; segment < segments; ++segment) {
+            if (!(frame->segments[digit] & BIT(segment))) {
+                continue;
+            }
+            anode = dev_impl->charlieplex_leds[(digit * segments + segment) * 2];
+            cathode = dev_impl->charlieplex_leds[(digit * segments + segment) * 2 + 1];
+            if (
+                !anode
+                || !cathode
+            ) {
+                continue;
+            }
+            by_anode[anode - 1] |= BIT(cathode - 1);
+            by_cathode[cathode - 1] |= BIT(anode - 1);
+        }
+    }
+
+    // Plan both ways, and keep whichever plan is shorter.
+    memset(frame->plan_high, 0, num_pins * sizeof(*frame->plan_high));
+    memset(frame->plan_low, 0, num_pins * sizeof(*frame->plan_low));
+    anode_slots = gpio_segled_charlieplex_merge(by_anode, num_pins, frame->plan_high, frame->plan_low);
+    cathode_slots = gpio_segled_charlieplex_merge(by_cathode, num_pins, cathode_low, cathode_high);
+    if (cathode_slots < anode_slots) {
+        memset(frame->plan_high, 0, num_pins * sizeof(*frame->plan_high));
+        memset(frame->plan_low, 0, num_pins * sizeof(*frame->plan_low));
+        memcpy(frame->plan_high, cathode_high, cathode_slots * sizeof(*frame->plan_high));
+        memcpy(frame->plan_low, cathode_low, cathode_slots * sizeof(*frame->plan_low));
+    }
+}
+
+/**
+ * This works out the segment bitmaps of a frame from the given digits and
+ * decimal points, and (for color panels) the colors of the frame.  On a
+ * color panel, each digit lights its segments in each channel of its color
+ * that isn't zero.
+ */
+static void gpio_segled_render_digits(struct gpio_segled_device* dev_impl, struct gpio_segled_frame* frame, const char* digits, const int* decimal_points) {
+    struct gpio_segled_bus* bus = dev_impl->bus;
+    u32 segments;
+    int digit, channel;
+
+    if (!bus->type) {
+        gpio_segled_render_text(dev_impl, frame, digits);
+        return;
+    }
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        segments = gpio_segled_map_digit(bus->type, &dev_impl->map, digits[digit], decimal_points[digit]);
+        if (bus->channels > 1) {
+            frame->segments[digit] = 0;
+            for (channel = 0; channel < bus->channels; ++channel) {
+                if (gpio_segled_color_level(frame->colors[digit], channel)) {
+                    frame->segments[digit] |= segments << (channel * bus->type->num_gpios);
+                }
+            }
+        } else {
+            frame->segments[digit] = segments;
+        }
+    }
+}
+
+/**
+ * This works out the segment bitmaps of a frame of a panel from its
+ * digits, with the active layers of the panel shown over them.  Each
+ * digit shows the topmost layer which isn't blank there.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_render(struct gpio_segled_device* dev_impl, struct gpio_segled_frame* frame) {
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    struct gpio_segled_layer* layer;
+    int chr;
+
+    memcpy(digits, frame->digits, dev_impl->num_chars * sizeof(*digits));
+    memcpy(decimal_points, frame->decimal_points, dev_impl->num_chars * sizeof(*decimal_points));
+    for (layer = dev_impl->layers; layer < dev_impl->layers + NUM_LAYERS; ++layer) {
+        if (!layer->active) {
+            continue;
+        }
+        for (chr = 0; chr < dev_impl->num_chars; ++chr) {
+            if (
+                (layer->digits[chr] != ' ')
+                || layer->decimal_points[chr]
+            ) {
+                digits[chr] = layer->digits[chr];
+                decimal_points[chr] = layer->decimal_points[chr];
+            }
+        }
+    }
+    gpio_segled_render_digits(dev_impl, frame, digits, decimal_points);
+    frame->raw_segments = 0;
+}
+
+/**
+ * This begins staging a new frame for a panel.  Unless a frame is already
+ * staged, the staged frame is out of date, so it starts out as a copy of
+ * the shown frame, to be changed only where new content is given.
+ *
+ * It must be called with the bus lock held.
+ */
+static struct gpio_segled_frame* gpio_segled_begin_stage(struct gpio_segled_device* dev_impl) {
+    struct gpio_segled_frame* staged = dev_impl->staged;
+    struct gpio_segled_frame* shown = dev_impl->shown;
+
+    if (!dev_impl->commit_pending) {
+        memcpy(staged->digits, shown->digits, dev_impl->num_chars * sizeof(*staged->digits));
+        memcpy(staged->decimal_points, shown->decimal_points, dev_impl->num_chars * sizeof(*staged->decimal_points));
+        memcpy(staged->segments, shown->segments, dev_impl->num_digits * sizeof(*staged->segments));
+        if (staged->colors) {
+            memcpy(staged->colors, shown->colors, dev_impl->num_digits * sizeof(*staged->colors));
+        }
+        memcpy(staged->digit_brightness, shown->digit_brightness, dev_impl->num_digits * sizeof(*staged->digit_brightness));
+        staged->raw_segments = shown->raw_segments;
+        staged->brightness_percent = -1;
+        staged->refresh_rate_hz = 0;
+        staged->blink_given = 0;
+        staged->digit_blink_given = 0;
+    }
+    return staged;
+}
+
+/**
+ * This finishes staging a new frame for a panel, to be latched at the
+ * start of the first scanning cycle at or after the given time.  Panels
+ * whose backend does its own scanning have no scanning cycle, so for them
+ * the scanning timer is set to go off at the given time instead.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_finish_stage(struct gpio_segled_device* dev_impl, ktime_t commit_at) {
+    if (dev_impl->bus->charlieplex) {
+        gpio_segled_plan_charlieplex(dev_impl, dev_impl->staged);
+    }
+    dev_impl->commit_pending = 1;
+    dev_impl->commit_at = commit_at;
+    if (
+        dev_impl->bus->ops->update
+        && dev_impl->bus->num_panels
+    ) {
+        hrtimer_start(&dev_impl->bus->digit_timer, commit_at, HRTIMER_MODE_ABS);
+    }
+}
+
+/**
+ * This stages digits to be shown on a panel, replacing whatever was
+ * staged before, along with new colors for them if given.  They are
+ * latched at the start of the first scanning cycle at or after the
+ * given time.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_stage_digits(struct gpio_segled_device* dev_impl, const char* digits, const int* decimal_points, const u32* colors, ktime_t commit_at) {
+    struct gpio_segled_frame* frame = gpio_segled_begin_stage(dev_impl);
+    memcpy(frame->digits, digits, dev_impl->num_chars * sizeof(*digits));
+    memcpy(frame->decimal_points, decimal_points, dev_impl->num_chars * sizeof(*decimal_points));
+    if (
+        colors
+        && frame->colors
+    ) {
+        memcpy(frame->colors, colors, dev_impl->num_digits * sizeof(*colors));
+    }
+    gpio_segled_render(dev_impl, frame);
+    gpio_segled_finish_stage(dev_impl, commit_at);
+}
+
+/**
+ * This gives the number of bits in the segment bitmap of each digit of a
+ * panel: one for each segment GPIO (or column) of its bus, or for
+ * charlieplexed panels, one for each segment of a digit.
+ */
+static int gpio_segled_segment_bits(struct gpio_segled_device* dev_impl) {
+    return dev_impl->bus->charlieplex ? dev_impl->bus->type->num_gpios : dev_impl->bus->num_gpios;
+}
+
+/**
+ * This gives the mask of the bits of a segment bitmap which select
+ * segments of a panel.  Backends which put the digits of a bus right after
+ * its segments (in one array of GPIOs, or one word shifted out) would take
+ * any bits above them for digits.
+ */
+static u32 gpio_segled_segment_mask(struct gpio_segled_device* dev_impl) {
+    return GENMASK(gpio_segled_segment_bits(dev_impl) - 1, 0);
+}
+
+/**
+ * This stages segment bitmaps to be shown on a panel as they are, without
+ * any conversion from characters, to be latched at the start of the first
+ * scanning cycle at or after the given time.  Any bits above the segments
+ * of the panel are dropped.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_stage_segments(struct gpio_segled_device* dev_impl, const u32* segments, ktime_t commit_at) {
+    struct gpio_segled_frame* frame = gpio_segled_begin_stage(dev_impl);
+    u32 mask = gpio_segled_segment_mask(dev_impl);
+    int digit;
+
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        frame->segments[digit] = segments[digit] & mask;
+    }
+    frame->raw_segments = 1;
+    gpio_segled_finish_stage(dev_impl, commit_at);
+}
+
+/**
+ * This stages the frame published in the page a panel shares with
+ * userspace, if there is a new one and it can be read consistently, to be
+ * latched right away.  Otherwise it is left for the next scanning cycle,
+ * rather than waiting on the writer.
+ *
+ * It is called at the start of each scanning cycle, with the bus lock
+ * held.
+ */
+static void gpio_segled_take_shared(struct gpio_segled_device* dev_impl) {
+    struct segled_shared_frame* shared = dev_impl->shared;
+    u32 segments[MAX_DIGITS];
+    int num_digits = min(dev_impl->num_digits, SEGLED_SHARED_MAX_DIGITS);
+    u32 sequence, brightness_percent;
+    int digit;
+
+    sequence = READ_ONCE(shared->sequence);
+    if (
+        (sequence & 1)
+        || (sequence == dev_impl->shared_sequence)
+    ) {
+        return;
+    }
+    smp_rmb();
+    for (digit = 0; digit < num_digits; ++digit) {
+        segments[digit] = READ_ONCE(shared->segments[digit]);
+    }
+    for (; digit < dev_impl->num_digits; ++digit) {
+        segments[digit] = 0;
+    }
+    brightness_percent = READ_ONCE(shared->brightness_percent);
+    smp_rmb();
+    if (READ_ONCE(shared->sequence) != sequence) {
+        return;
+    }
+
+    // Staging drops any bits the writer set above the segments of the
+    // panel, which would otherwise light other digits on some backends.
+    dev_impl->shared_sequence = sequence;
+    gpio_segled_stage_segments(dev_impl, segments, 0);
+    if (!dev_impl->pwm) {
+        dev_impl->brightness_percent = min(brightness_percent, 100U);
+    }
+}
+
+/**
+ * This stages the next frame in the queue of a panel, to be latched right
+ * away, once it is due: at its time, if it was given one, or else once the
+ * frame before it has been shown for its duration.  The queue goes back to
+ * its first frame if it loops.  Running out of frames leaves the last one
+ * shown, and counts as an underrun if that frame's duration was up before
+ * another frame was queued.
+ *
+ * It is called at the start of each scanning cycle, with the bus lock
+ * held.
+ */
+static void gpio_segled_take_queued(struct gpio_segled_device* dev_impl, ktime_t now) {
+    ktime_t due_at;
+
+    if (
+        (dev_impl->queue_pos >= dev_impl->queue_len)
+        && dev_impl->queue_loop
+    ) {
+        dev_impl->queue_pos = 0;
+    }
+    if (dev_impl->queue_pos >= dev_impl->queue_len) {
+        if (
+            dev_impl->queue_active
+            && segled_commit_due(ktime_to_ns(now), ktime_to_ns(dev_impl->queue_next_at), dev_impl->bus->cycle_ns)
+        ) {
+            ++dev_impl->queue_underruns;
+            dev_impl->queue_active = 0;
+        }
+        return;
+    }
+    if (ktime_to_ns(dev_impl->queue_times[dev_impl->queue_pos])) {
+        due_at = dev_impl->queue_times[dev_impl->queue_pos];
+    } else if (dev_impl->queue_active) {
+        due_at = dev_impl->queue_next_at;
+    } else {
+        due_at = now;
+    }
+    if (!segled_commit_due(ktime_to_ns(now), ktime_to_ns(due_at), dev_impl->bus->cycle_ns)) {
+        return;
+    }
+
+    // Time each frame from when it was due, rather than from when it was
+    // shown, so that rounding to scanning cycles never accumulates.  A
+    // frame with no duration stays shown until the next one is queued
+    // (or due at its time).
+    gpio_segled_stage_segments(dev_impl, &dev_impl->queue_segments[dev_impl->queue_pos * dev_impl->num_digits], 0);
+    dev_impl->queue_next_at = ktime_add_ms(due_at, dev_impl->queue_durations_ms[dev_impl->queue_pos]);
+    dev_impl->queue_active = (dev_impl->queue_durations_ms[dev_impl->queue_pos] > 0);
+    ++dev_impl->queue_pos;
+}
+
+/**
+ * This stages the step of the message of a panel starting at the given
+ * character, wrapping around to the start of the message, and padding
+ * with blanks if the message is shorter than the panel.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_stage_message(struct gpio_segled_device* dev_impl, int pos) {
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS] = {0};
+    int digit;
+
+    for (digit = 0; digit < dev_impl->num_chars; ++digit) {
+        if (dev_impl->message_len <= dev_impl->num_chars) {
+            digits[digit] = (digit < dev_impl->message_len) ? dev_impl->message[digit] : ' ';
+        } else {
+            digits[digit] = dev_impl->message[(pos + digit) % dev_impl->message_len];
+        }
+    }
+    gpio_segled_stage_digits(dev_impl, digits, decimal_points, NULL, 0);
+}
+
+/**
+ * This scrolls the message of a panel on by one character, once the step
+ * before has been shown for its time, timing each step from when the one
+ * before it was due.
+ *
+ * It is called at the start of each scanning cycle, with the bus lock
+ * held.
+ */
+static void gpio_segled_scroll(struct gpio_segled_device* dev_impl, ktime_t now) {
+    if (!segled_commit_due(ktime_to_ns(now), ktime_to_ns(dev_impl->scroll_next_at), dev_impl->bus->cycle_ns)) {
+        return;
+    }
+    gpio_segled_stage_message(dev_impl, dev_impl->scroll_pos);
+    dev_impl->scroll_pos = (dev_impl->scroll_pos + 1) % dev_impl->message_len;
+    dev_impl->scroll_next_at = ktime_add_ms(dev_impl->scroll_next_at, dev_impl->scroll_step_ms);
+}
+
+/**
+ * This tells whether something blinking in the given way is off the given
+ * number of milliseconds after blinking started.
+ */
+static int gpio_segled_blink_is_off(const struct gpio_segled_blink* blink, s64 elapsed_ms) {
+    u32 phase_ms;
+
+    if (!blink->period_ms) {
+        return 0;
+    }
+    div_u64_rem(max_t(s64, elapsed_ms, 0), blink->period_ms, &phase_ms);
+    return (u64)phase_ms * 100 >= (u64)blink->period_ms * blink->duty_percent;
+}
+
+/**
+ * This works out the brightness of a panel, and which of its digits are
+ * blinked off, for the scanning cycle starting at the given time.  Slots
+ * are then simply lit for less of their time (or not at all), so that
+ * blinking and fading need no timers of their own.
+ *
+ * It is called at the start of each scanning cycle, with the bus lock
+ * held.
+ */
+static void gpio_segled_run_effects(struct gpio_segled_device* dev_impl, ktime_t now) {
+    s64 elapsed_ms;
+    int digit;
+
+    // Fade from the brightness the panel is lit at whenever a new
+    // brightness is set.
+    if (dev_impl->brightness_percent != dev_impl->fade_to_percent) {
+        dev_impl->fade_from_percent = dev_impl->level_percent;
+        dev_impl->fade_to_percent = dev_impl->brightness_percent;
+        dev_impl->fade_start = now;
+    }
+    elapsed_ms = max_t(s64, ktime_ms_delta(now, dev_impl->fade_start), 0);
+    if (elapsed_ms >= dev_impl->fade_ms) {
+        dev_impl->level_percent = dev_impl->fade_to_percent;
+    } else {
+        dev_impl->level_percent = dev_impl->fade_from_percent
+            + div_s64((dev_impl->fade_to_percent - dev_impl->fade_from_percent) * elapsed_ms, dev_impl->fade_ms);
+    }
+
+    // Blink the whole panel, and then any digits blinking on their own.
+    elapsed_ms = ktime_ms_delta(now, dev_impl->blink_epoch);
+    dev_impl->blink_off = gpio_segled_blink_is_off(&dev_impl->blink, elapsed_ms);
+    dev_impl->digits_blinked_off = 0;
+    if (dev_impl->digit_blink_set) {
+        for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+            if (gpio_segled_blink_is_off(&dev_impl->digit_blink[digit], elapsed_ms)) {
+                dev_impl->digits_blinked_off |= BIT(digit);
+            }
+        }
+    }
+}
+
+/**
+ * This redraws the frame of a panel from its text, after something it is
+ * drawn with (its layers or conversion map) has changed, to be latched at
+ * the start of the next scanning cycle.  Frames whose segments were given
+ * as they are aren't drawn from text, and are left alone.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_restage_text(struct gpio_segled_device* dev_impl) {
+    struct gpio_segled_frame* frame = gpio_segled_begin_stage(dev_impl);
+    if (frame->raw_segments) {
+        return;
+    }
+    gpio_segled_render(dev_impl, frame);
+    gpio_segled_finish_stage(dev_impl, 0);
+}
+
+/**
+ * This works out when the next of the layers of a panel expires, or zero
+ * if none of them do.
+ *
+ * It must be called with the bus lock held.
+ */
+static void gpio_segled_next_layer_expiry(struct gpio_segled_device* dev_impl) {
+    struct gpio_segled_layer* layer;
+
+    dev_impl->layers_expire_at = 0;
+    for (layer = dev_impl->layers; layer < dev_impl->layers + NUM_LAYERS; ++layer) {
+        if (
+            layer->active
+            && ktime_to_ns(layer->expires_at)
+            && (
+                !ktime_to_ns(dev_impl->layers_expire_at)
+                || ktime_before(layer->expires_at, dev_impl->layers_expire_at)
+            )
+        ) {
+            dev_impl->layers_expire_at = layer->expires_at;
+        }
+    }
+}
+
+/**
+ * This drops the layers of a panel which have expired by the scanning
+ * cycle starting at the given time, restaging its frame without them.
+ *
+ * It is called at the start of each scanning cycle in which a layer is
+ * due to expire, with the bus lock held.
+ */
+static void gpio_segled_expire_layers(struct gpio_segled_device* dev_impl, ktime_t now) {
+    struct gpio_segled_layer* layer;
+
+    for (layer = dev_impl->layers; layer < dev_impl->layers + NUM_LAYERS; ++layer) {
+        if (
+            layer->active
+            && ktime_to_ns(layer->expires_at)
+            && segled_commit_due(ktime_to_ns(now), ktime_to_ns(layer->expires_at), dev_impl->bus->cycle_ns)
+        ) {
+            layer->active = 0;
+        }
+    }
+    gpio_segled_next_layer_expiry(dev_impl);
+    gpio_segled_restage_text(dev_impl);
+}
+
+/**
+ * This copies out the digits most recently given for a panel, whether
+ * or not they have been latched yet.
+ */
+static void gpio_segled_get_digits(struct gpio_segled_device* dev_impl, char* digits, int* decimal_points) {
+    struct gpio_segled_frame* frame;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = dev_impl->commit_pending ? dev_impl->staged : dev_impl->shown;
+    memcpy(digits, frame->digits, dev_impl->num_chars * sizeof(*digits));
+    memcpy(decimal_points, frame->decimal_points, dev_impl->num_chars * sizeof(*decimal_points));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+}
+
+// digits attribute: the characters to show on the LEDs
+
+static ssize_t digits_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    gpio_segled_get_digits(dev_impl, digits, decimal_points);
+    return gpio_segled_format_digits(buf, 0, dev_impl->num_chars, digits, decimal_points);
+}
+
+/**
+ * This parses the characters to show on a panel, as written to its
+ * "digits" attribute or its character device, and stages them to be
+ * latched at the start of the next scanning cycle.
+ */
+static int gpio_segled_store_digits(struct gpio_segled_device* dev_impl, const char* buf, size_t len) {
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    u32 colors[MAX_DIGITS];
+    char color[7];
+    unsigned long flags;
+    size_t skip = 0;
+    int digit;
+
+    // Color panels take an optional color for all the digits ahead of
+    // them, as in "#ff8000 12.34".
+    if (
+        (dev_impl->bus->channels > 1)
+        && (len >= 7)
+        && (buf[0] == '#')
+    ) {
+        memcpy(color, buf + 1, 6);
+        color[6] = '\0';
+        if (kstrtou32(color, 16, &colors[0])) {
+            return -EINVAL;
+        }
+        for (digit = 1; digit < dev_impl->num_digits; ++digit) {
+            colors[digit] = colors[0];
+        }
+        skip = 7;
+        if (
+            (len > skip)
+            && (buf[skip] == ' ')
+        ) {
+            ++skip;
+        }
+    }
+
+    // Parse the new digits and have them latched at the start
+    // of the next scanning cycle, replacing any message.
+    segled_parse_digits(buf + skip, len - skip, dev_impl->num_chars, digits, decimal_points);
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    dev_impl->message_len = 0;
+    gpio_segled_stage_digits(dev_impl, digits, decimal_points, skip ? colors : NULL, 0);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return 0;
+}
+
+static ssize_t digits_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    int ret = gpio_segled_store_digits(dev_impl, buf, len);
+    if (ret) {
+        return ret;
+    }
+
+    // Always return size of input buffer to prevent the user from doing
+    // something silly like trying to write for a second time.
+    return len;
+}
+
+static DEVICE_ATTR_RW(digits);
+
+/**
+ * This parses the brightness of each digit of a panel, separated by
+ * spaces or commas, giving the number of characters parsed.
+ */
+static int gpio_segled_parse_digit_brightness(struct gpio_segled_device* dev_impl, const char* buf, u8* digit_brightness) {
+    const char* start = buf;
+    unsigned int percent;
+    int consumed, digit = 0;
+
+    while (digit < dev_impl->num_digits) {
+        while (
+            (*buf == ' ')
+            || (*buf == ',')
+        ) {
+            ++buf;
+        }
+        if (sscanf(buf, "%u%n", &percent, &consumed) != 1) {
+            break;
+        }
+        if (percent > 100) {
+            return -EINVAL;
+        }
+        digit_brightness[digit++] = percent;
+        buf += consumed;
+    }
+    if (!digit) {
+        return -EINVAL;
+    }
+    for (; digit < dev_impl->num_digits; ++digit) {
+        digit_brightness[digit] = digit_brightness[digit - 1];
+    }
+    return buf - start;
+}
+
+/**
+ * This parses how something blinks, as a period in milliseconds, then
+ * optionally the given separator and a duty cycle in percent (50 if not
+ * given), giving the number of characters parsed.
+ */
+static int gpio_segled_parse_blink(const char* buf, char separator, struct gpio_segled_blink* blink) {
+    const char* start = buf;
+    int consumed;
+
+    if (sscanf(buf, "%u%n", &blink->period_ms, &consumed) != 1) {
+        return -EINVAL;
+    }
+    buf += consumed;
+    blink->duty_percent = 50;
+    if (*buf == separator) {
+        if (sscanf(buf + 1, "%u%n", &blink->duty_percent, &consumed) != 1) {
+            return -EINVAL;
+        }
+        buf += 1 + consumed;
+    }
+    if (blink->duty_percent > 100) {
+        return -EINVAL;
+    }
+    return buf - start;
+}
+
+/**
+ * This checks that a panel can blink as given.  Backends which do their
+ * own scanning have no slots to blink, but the HT16K33 blinks its whole
+ * display by itself, half the time on, so for them the period is rounded
+ * to the nearest rate the chip has.
+ */
+static int gpio_segled_check_blink(struct gpio_segled_device* dev_impl, struct gpio_segled_blink* blink) {
+    if (dev_impl->bus->ops->update) {
+        if (
+            blink->period_ms
+            && (blink->duty_percent != 50)
+        ) {
+            return -EINVAL;
+        }
+        blink->period_ms = gpio_segled_controller_blink_periods_ms[gpio_segled_controller_blink_rate(blink->period_ms)];
+    }
+    return 0;
+}
+
+/**
+ * This parses how each digit of a panel blinks, separated by spaces or
+ * commas, each as a period in milliseconds optionally followed by a colon
+ * and a duty cycle in percent, giving the number of characters parsed.
+ * If fewer are given than there are digits, the last one given is used
+ * for the rest.  Backends which do their own scanning have no slots to
+ * blink, and charlieplexed panels don't light one digit at a time.
+ */
+static int gpio_segled_parse_digit_blink(struct gpio_segled_device* dev_impl, const char* buf, struct gpio_segled_blink* digit_blink) {
+    const char* start = buf;
+    int consumed, digit = 0;
+
+    if (
+        dev_impl->bus->ops->update
+        || dev_impl->bus->charlieplex
+    ) {
+        return -EOPNOTSUPP;
+    }
+    while (digit < dev_impl->num_digits) {
+        while (
+            (*buf == ' ')
+            || (*buf == ',')
+        ) {
+            ++buf;
+        }
+        if (!isdigit(*buf)) {
+            break;
+        }
+        consumed = gpio_segled_parse_blink(buf, ':', &digit_blink[digit]);
+        if (consumed < 0) {
+            return consumed;
+        }
+        buf += consumed;
+        ++digit;
+    }
+    if (!digit) {
+        return -EINVAL;
+    }
+    for (; digit < dev_impl->num_digits; ++digit) {
+        digit_blink[digit] = digit_blink[digit - 1];
+    }
+    return buf - start;
+}
+
+// frame attribute: the characters to show, along with the brightness,
+// refresh rate, brightness of each digit, blinking of the panel and of
+// each digit and (for color panels) color to show them with, as settings
+// separated by spaces ("brightness=80 refresh=120 digit_brightness=100,50
+// blink=500:50 digit_blink=0,0,250 color=ff8000 digits=12.34"), all
+// latched together at the start of the next scanning cycle; settings not
+// given are left as they are, and the characters, given last, run to the
+// end of the line
+
+static ssize_t frame_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    struct gpio_segled_frame* frame;
+    int brightness_percent;
+    unsigned long refresh_rate_hz;
+    unsigned long flags;
+    ssize_t len;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = dev_impl->commit_pending ? dev_impl->staged : dev_impl->shown;
+    memcpy(digits, frame->digits, dev_impl->num_chars * sizeof(*digits));
+    memcpy(decimal_points, frame->decimal_points, dev_impl->num_chars * sizeof(*decimal_points));
+    brightness_percent = (frame->brightness_percent >= 0) ? frame->brightness_percent : dev_impl->brightness_percent;
+    refresh_rate_hz = frame->refresh_rate_hz ? frame->refresh_rate_hz : dev_impl->bus->refresh_rate_hz;
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+
+    len = scnprintf(buf, PAGE_SIZE, "brightness=%d refresh=%lu digits=", brightness_percent, refresh_rate_hz);
+    return gpio_segled_format_digits(buf, len, dev_impl->num_chars, digits, decimal_points);
+}
+
+static ssize_t frame_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    struct gpio_segled_frame* frame;
+    const char* text = NULL;
+    const char* end = buf + len;
+    const char* newline;
+    size_t text_len = 0;
+    int brightness_percent = -1;
+    unsigned long refresh_rate_hz = 0;
+    u32 color = 0;
+    int has_color = 0;
+    u8 digit_brightness[MAX_DIGITS];
+    int has_digit_brightness = 0;
+    struct gpio_segled_blink blink;
+    int has_blink = 0;
+    struct gpio_segled_blink digit_blink[MAX_DIGITS];
+    int has_digit_blink = 0;
+    unsigned long flags;
+    int consumed;
+    int digit;
+    int ret;
+
+    // Parse all the settings first, so that nothing changes unless they
+    // are all valid.
+    while (buf < end) {
+        if (
+            (*buf == ' ')
+            || (*buf == '\n')
+        ) {
+            ++buf;
+            continue;
+        }
+        if (!strncmp(buf, "digits=", 7)) {
+            text = buf + 7;
+            newline = memchr(text, '\n', end - text);
+            text_len = (newline ? newline : end) - text;
+            buf = text + text_len;
+        } else if (!strncmp(buf, "digit_brightness=", 17)) {
+            consumed = gpio_segled_parse_digit_brightness(dev_impl, buf + 17, digit_brightness);
+            if (consumed < 0) {
+                return consumed;
+            }
+            has_digit_brightness = 1;
+            buf += 17 + consumed;
+        } else if (!strncmp(buf, "digit_blink=", 12)) {
+            consumed = gpio_segled_parse_digit_blink(dev_impl, buf + 12, digit_blink);
+            if (consumed < 0) {
+                return consumed;
+            }
+            has_digit_blink = 1;
+            buf += 12 + consumed;
+        } else if (!strncmp(buf, "blink=", 6)) {
+            consumed = gpio_segled_parse_blink(buf + 6, ':', &blink);
+            if (consumed < 0) {
+                return consumed;
+            }
+            ret = gpio_segled_check_blink(dev_impl, &blink);
+            if (ret) {
+                return ret;
+            }
+            has_blink = 1;
+            buf += 6 + consumed;
+        } else if (sscanf(buf, "brightness=%d%n", &brightness_percent, &consumed) == 1) {
+            if (
+                (brightness_percent < 0)
+                || (brightness_percent > 100)
+            ) {
+                return -EINVAL;
+            }
+            buf += consumed;
+        } else if (sscanf(buf, "refresh=%lu%n", &refresh_rate_hz, &consumed) == 1) {
+            if (!refresh_rate_hz) {
+                return -EINVAL;
+            }
+            buf += consumed;
+        } else if (
+            (dev_impl->bus->channels > 1)
+            && (sscanf(buf, "color=%6x%n", &color, &consumed) == 1)
+        ) {
+            has_color = 1;
+            buf += consumed;
+        } else {
+            return -EINVAL;
+        }
+    }
+    if (text) {
+        segled_parse_digits(text, text_len, dev_impl->num_chars, digits, decimal_points);
+    }
+
+    // Panels dimmed by a PWM have it set right away, as that may sleep.
+    if (
+        dev_impl->pwm
+        && (brightness_percent >= 0)
+    ) {
+        dev_impl->brightness_percent = brightness_percent;
+        gpio_segled_apply_pwm(dev_impl, 1);
+        brightness_percent = -1;
+    }
+
+    // Stage everything together, to be latched at the start of the next
+    // scanning cycle.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = gpio_segled_begin_stage(dev_impl);
+    if (text) {
+        dev_impl->message_len = 0;
+        memcpy(frame->digits, digits, dev_impl->num_chars * sizeof(*digits));
+        memcpy(frame->decimal_points, decimal_points, dev_impl->num_chars * sizeof(*decimal_points));
+    }
+    if (has_color) {
+        for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+            frame->colors[digit] = color;
+        }
+    }
+    if (
+        text
+        || (
+            has_color
+            && !frame->raw_segments
+        )
+    ) {
+        gpio_segled_render(dev_impl, frame);
+    }
+    if (brightness_percent >= 0) {
+        frame->brightness_percent = brightness_percent;
+    }
+    if (has_digit_brightness) {
+        memcpy(frame->digit_brightness, digit_brightness, dev_impl->num_digits * sizeof(*digit_brightness));
+    }
+    if (refresh_rate_hz) {
+        frame->refresh_rate_hz = refresh_rate_hz;
+    }
+    if (has_blink) {
+        frame->blink = blink;
+        frame->blink_given = 1;
+    }
+    if (has_digit_blink) {
+        memcpy(frame->digit_blink, digit_blink, dev_impl->num_digits * sizeof(*digit_blink));
+        frame->digit_blink_given = 1;
+    }
+    gpio_segled_finish_stage(dev_impl, 0);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(frame);
+
+// queue attribute: frames to show one after another, one per line, each
+// as a duration in milliseconds ("250 12.34"), or "@" and a time in
+// nanoseconds of the monotonic clock ("@5000000000 12.34"), followed by the
+// characters to show; a line "loop" makes the queue start over once all
+// its frames have been shown, and "clear" empties it; reading gives the
+// number of frames still to show (or all of them, for a looping queue)
+
+/**
+ * This checks a line written to the queue attribute, giving the number of
+ * characters of the duration or time (and the space after it) of a frame,
+ * or zero for "loop" and "clear".  A frame given a time has no duration,
+ * and a frame given a duration has a time of zero.
+ */
+static int gpio_segled_parse_queue_line(const char* line, size_t len, unsigned int* duration_ms, ktime_t* time) {
+    unsigned long long time_ns;
+    int consumed;
+
+    if (
+        ((len == 4) && !strncmp(line, "loop", 4))
+        || ((len == 5) && !strncmp(line, "clear", 5))
+    ) {
+        return 0;
+    }
+    *duration_ms = 0;
+    *time = 0;
+    if (line[0] == '@') {
+        if (
+            (sscanf(line + 1, "%llu%n", &time_ns, &consumed) != 1)
+            || !time_ns
+            || (time_ns > KTIME_MAX)
+            || (++consumed > len)
+        ) {
+            return -EINVAL;
+        }
+        *time = ns_to_ktime(time_ns);
+    } else if (
+        (sscanf(line, "%u%n", duration_ms, &consumed) != 1)
+        || (consumed > len)
+    ) {
+        return -EINVAL;
+    }
+    if (
+        (consumed < len)
+        && (line[consumed] == ' ')
+    ) {
+        ++consumed;
+    }
+    return consumed;
+}
+
+/**
+ * This goes through the lines written to the queue attribute, all of them
+ * already checked, and queues their frames (or loops or clears the queue).
+ * Unless apply is set, it only works out whether there is room for all of
+ * them, leaving the queue as it is, so that either all of them are queued
+ * or none of them.
+ *
+ * It must be called with the bus lock held.
+ */
+static int gpio_segled_queue_lines(struct gpio_segled_device* dev_impl, const char* buf, size_t len, int apply) {
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    u32 colors[MAX_DIGITS];
+    struct gpio_segled_frame frame = {
+        .digits = digits,
+        .decimal_points = decimal_points,
+    };
+    int queue_len = dev_impl->queue_len;
+    int queue_pos = dev_impl->queue_pos;
+    int queue_loop = dev_impl->queue_loop;
+    const char* end = buf + len;
+    const char* line;
+    const char* newline;
+    unsigned int duration_ms;
+    size_t line_len;
+    ktime_t time;
+    int consumed;
+
+    if (
+        apply
+        && (dev_impl->bus->channels > 1)
+    ) {
+        memcpy(colors, dev_impl->shown->colors, dev_impl->num_digits * sizeof(*colors));
+        frame.colors = colors;
+    }
+    for (line = buf; line < end; line += line_len + 1) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline ? newline : end) - line;
+        if (!line_len) {
+            continue;
+        }
+        consumed = gpio_segled_parse_queue_line(line, line_len, &duration_ms, &time);
+        if (!consumed) {
+            if (line[0] == 'l') {
+                queue_loop = 1;
+            } else {
+                queue_len = 0;
+                queue_pos = 0;
+                queue_loop = 0;
+                if (apply) {
+                    dev_impl->queue_active = 0;
+                }
+            }
+            continue;
+        }
+
+        // Make room by dropping the frames already shown, unless the
+        // queue loops.
+        if (
+            (queue_len >= QUEUE_FRAMES)
+            && !queue_loop
+            && queue_pos
+        ) {
+            if (apply) {
+                memmove(dev_impl->queue_segments, &dev_impl->queue_segments[queue_pos * dev_impl->num_digits], (queue_len - queue_pos) * dev_impl->num_digits * sizeof(*dev_impl->queue_segments));
+                memmove(dev_impl->queue_durations_ms, &dev_impl->queue_durations_ms[queue_pos], (queue_len - queue_pos) * sizeof(*dev_impl->queue_durations_ms));
+                memmove(dev_impl->queue_times, &dev_impl->queue_times[queue_pos], (queue_len - queue_pos) * sizeof(*dev_impl->queue_times));
+            }
+            queue_len -= queue_pos;
+            queue_pos = 0;
+        }
+        if (queue_len >= QUEUE_FRAMES) {
+            return -ENOSPC;
+        }
+
+        // Work out the segments of the frame now, so that showing it
+        // takes no conversions.
+        if (apply) {
+            segled_parse_digits(line + consumed, line_len - consumed, dev_impl->num_chars, digits, decimal_points);
+            frame.segments = &dev_impl->queue_segments[queue_len * dev_impl->num_digits];
+            gpio_segled_render_digits(dev_impl, &frame, digits, decimal_points);
+            dev_impl->queue_durations_ms[queue_len] = duration_ms;
+            dev_impl->queue_times[queue_len] = time;
+        }
+        ++queue_len;
+    }
+    if (apply) {
+        dev_impl->queue_len = queue_len;
+        dev_impl->queue_pos = queue_pos;
+        dev_impl->queue_loop = queue_loop;
+    }
+    return 0;
+}
+
+static ssize_t queue_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    unsigned long flags;
+    int frames;
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frames = dev_impl->queue_loop ? dev_impl->queue_len : (dev_impl->queue_len - dev_impl->queue_pos);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return scnprintf(buf, PAGE_SIZE, "%d", frames);
+}
+
+static ssize_t queue_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    const char* end = buf + len;
+    const char* line;
+    const char* newline;
+    unsigned int duration_ms;
+    unsigned long flags;
+    size_t line_len;
+    ktime_t time;
+    int ret;
+
+    // Backends which do their own scanning have no scanning cycle to
+    // switch frames at.
+    if (dev_impl->bus->ops->update) {
+        return -EOPNOTSUPP;
+    }
+
+    // Check every line before queueing any of them.
+    for (line = buf; line < end; line += line_len + 1) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline ? newline : end) - line;
+        if (
+            line_len
+            && (gpio_segled_parse_queue_line(line, line_len, &duration_ms, &time) < 0)
+        ) {
+            return -EINVAL;
+        }
+    }
+
+    // Queue all of the frames, or none of them if there isn't room.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    ret = gpio_segled_queue_lines(dev_impl, buf, len, 0);
+    if (!ret) {
+        ret = gpio_segled_queue_lines(dev_impl, buf, len, 1);
+    }
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return ret ? ret : len;
+}
+
+static DEVICE_ATTR_RW(queue);
+
+// queue_underruns attribute: how many times the frame queue has run out
+// of frames to show while the last frame shown had a duration, so that
+// another frame was expected after it
+
+static ssize_t queue_underruns_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    unsigned long flags;
+    u64 underruns;
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    underruns = dev_impl->queue_underruns;
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return scnprintf(buf, PAGE_SIZE, "%llu", underruns);
+}
+
+static DEVICE_ATTR_RO(queue_underruns);
+
+// message attribute: text to show one character per digit, as for other
+// auxdisplay drivers, scrolling if it is longer than the panel (writing
+// to the digits attribute replaces it)
+
+static ssize_t message_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    unsigned long flags;
+    ssize_t len;
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    len = scnprintf(buf, PAGE_SIZE, "%.*s", dev_impl->message_len, dev_impl->message ? dev_impl->message : "");
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static ssize_t message_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    size_t message_len = len;
+    char* message;
+    char* old_message;
+    unsigned long flags;
+
+    // A trailing newline isn't part of the message.
+    if (
+        message_len
+        && (buf[message_len - 1] == '\n')
+    ) {
+        --message_len;
+    }
+    message = kmemdup_nul(buf, message_len, GFP_KERNEL);
+    if (!message) {
+        return -ENOMEM;
+    }
+
+    // Show the start of the message right away, and scroll on from there
+    // if it is longer than the panel.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    old_message = dev_impl->message;
+    dev_impl->message = message;
+    dev_impl->message_len = message_len;
+    gpio_segled_stage_message(dev_impl, 0);
+    dev_impl->scroll_pos = message_len ? (1 % message_len) : 0;
+    dev_impl->scroll_next_at = ktime_add_ms(ktime_get(), dev_impl->scroll_step_ms);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    kfree(old_message);
+    return len;
+}
+
+static DEVICE_ATTR_RW(message);
+
+// scroll_step_ms attribute: how long each step of a scrolling message is
+// shown for, in milliseconds (zero stops scrolling)
+
+static ssize_t scroll_step_ms_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    return scnprintf(buf, PAGE_SIZE, "%u", dev_impl->scroll_step_ms);
+}
+
+static ssize_t scroll_step_ms_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    unsigned int scroll_step_ms;
+    unsigned long flags;
+
+    if (kstrtouint(buf, 10, &scroll_step_ms)) {
+        return -EINVAL;
+    }
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    dev_impl->scroll_step_ms = scroll_step_ms;
+    dev_impl->scroll_next_at = ktime_add_ms(ktime_get(), scroll_step_ms);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(scroll_step_ms);
+
+// blink attribute: how the whole panel blinks, as a period in milliseconds
+// and the percentage of it the panel is on for ("500 50", the percentage
+// being 50 if not given), or zero for no blinking
+
+static ssize_t blink_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    return scnprintf(buf, PAGE_SIZE, "%u %u", dev_impl->blink.period_ms, dev_impl->blink.duty_percent);
+}
+
+static ssize_t blink_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_blink blink;
+    unsigned long flags;
+    int ret;
+
+    ret = gpio_segled_parse_blink(skip_spaces(buf), ' ', &blink);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = gpio_segled_check_blink(dev_impl, &blink);
+    if (ret) {
+        return ret;
+    }
+
+    // Start blinking on, together with any digits blinking on their own.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    dev_impl->blink = blink;
+    dev_impl->blink_epoch = ktime_get();
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+
+    // Have the controller take the new blinking rate.  The bus can't have
+    // stopped yet, since panels are deleted before their buses stop.
+    if (dev_impl->bus->ops->update) {
+        (void)schedule_work(&dev_impl->bus->update_digits_work);
+    }
+    return len;
+}
+
+static DEVICE_ATTR_RW(blink);
+
+// digit_blink attribute: how each digit blinks on its own, as periods in
+// milliseconds separated by spaces, each optionally followed by a colon
+// and the percentage of it the digit is on for ("0 0 500:25 500:25"); if
+// fewer are given than there are digits, the last one given is used for
+// the rest
+
+static ssize_t digit_blink_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_blink digit_blink[MAX_DIGITS];
+    unsigned long flags;
+    ssize_t len = 0;
+    int digit;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(digit_blink, dev_impl->digit_blink, dev_impl->num_digits * sizeof(*digit_blink));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s%u:%u", digit ? " " : "", digit_blink[digit].period_ms, digit_blink[digit].duty_percent);
+    }
+    return len;
+}
+
+static ssize_t digit_blink_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_blink digit_blink[MAX_DIGITS];
+    unsigned long flags;
+    int digit_blink_set = 0;
+    int digit;
+    int ret;
+
+    ret = gpio_segled_parse_digit_blink(dev_impl, skip_spaces(buf), digit_blink);
+    if (ret < 0) {
+        return ret;
+    }
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        if (digit_blink[digit].period_ms) {
+            digit_blink_set = 1;
+        }
+    }
+
+    // Start blinking on, together with the panel itself.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(dev_impl->digit_blink, digit_blink, dev_impl->num_digits * sizeof(*digit_blink));
+    dev_impl->digit_blink_set = digit_blink_set;
+    dev_impl->blink_epoch = ktime_get();
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(digit_blink);
+
+// fade_ms attribute: how long a change of brightness takes to fade in, in
+// milliseconds (zero for right away)
+
+static ssize_t fade_ms_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    return scnprintf(buf, PAGE_SIZE, "%u", dev_impl->fade_ms);
+}
+
+static ssize_t fade_ms_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    unsigned int fade_ms;
+    unsigned long flags;
+
+    if (
+        kstrtouint(buf, 10, &fade_ms)
+        || (fade_ms > INT_MAX)
+    ) {
+        return -EINVAL;
+    }
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    dev_impl->fade_ms = fade_ms;
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(fade_ms);
+
+// layers attribute: text shown over the digits of the panel, one layer per
+// line, each as the number of the layer (1 to NUM_LAYERS, the higher ones
+// on top), how long to show it for in milliseconds (zero for until it is
+// replaced) and the characters to show ("2 5000 AL"); a line "2 clear"
+// removes a layer; reading gives the active layers in the same form, with
+// the time they have left
+
+/**
+ * This checks a line written to the layers attribute, giving the layer and
+ * how long to show it for, along with the number of characters before the
+ * text of the layer, or zero for a layer to be cleared.
+ */
+static int gpio_segled_parse_layer_line(const char* line, size_t len, int* layer, unsigned int* lifetime_ms) {
+    int consumed, consumed_ms;
+
+    if (
+        (sscanf(line, "%d%n", layer, &consumed) != 1)
+        || (*layer < 1)
+        || (*layer > NUM_LAYERS)
+        || (consumed >= len)
+        || (line[consumed] != ' ')
+    ) {
+        return -EINVAL;
+    }
+    ++consumed;
+    if (
+        (len - consumed == 5)
+        && !strncmp(line + consumed, "clear", 5)
+    ) {
+        return 0;
+    }
+    if (
+        (sscanf(line + consumed, "%u%n", lifetime_ms, &consumed_ms) != 1)
+        || (consumed + consumed_ms > len)
+    ) {
+        return -EINVAL;
+    }
+    consumed += consumed_ms;
+    if (
+        (consumed < len)
+        && (line[consumed] == ' ')
+    ) {
+        ++consumed;
+    }
+    return consumed;
+}
+
+static ssize_t layers_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_layer layers[NUM_LAYERS];
+    unsigned long flags;
+    ktime_t now;
+    s64 left_ms;
+    ssize_t len = 0;
+    int layer;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(layers, dev_impl->layers, sizeof(layers));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    now = ktime_get();
+    for (layer = 0; layer < NUM_LAYERS; ++layer) {
+        if (!layers[layer].active) {
+            continue;
+        }
+        left_ms = ktime_to_ns(layers[layer].expires_at) ? max_t(s64, ktime_ms_delta(layers[layer].expires_at, now), 1) : 0;
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s%d %lld ", len ? "\n" : "", layer + 1, left_ms);
+        len = gpio_segled_format_digits(buf, len, dev_impl->num_chars, layers[layer].digits, layers[layer].decimal_points);
+    }
+    return len;
+}
+
+static ssize_t layers_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_layer* layer;
+    const char* end = buf + len;
+    const char* line;
+    const char* newline;
+    unsigned int lifetime_ms;
+    unsigned long flags;
+    size_t line_len;
+    ktime_t now;
+    int consumed;
+    int layer_num;
+
+    // Backends which do their own scanning have no scanning cycle to
+    // expire layers at.
+    if (dev_impl->bus->ops->update) {
+        return -EOPNOTSUPP;
+    }
+
+    // Check every line before changing any layers.
+    for (line = buf; line < end; line += line_len + 1) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline ? newline : end) - line;
+        if (
+            line_len
+            && (gpio_segled_parse_layer_line(line, line_len, &layer_num, &lifetime_ms) < 0)
+        ) {
+            return -EINVAL;
+        }
+    }
+
+    // Change all the layers given, and then show them together from the
+    // start of the next scanning cycle.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    now = ktime_get();
+    for (line = buf; line < end; line += line_len + 1) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline ? newline : end) - line;
+        if (!line_len) {
+            continue;
+        }
+        consumed = gpio_segled_parse_layer_line(line, line_len, &layer_num, &lifetime_ms);
+        layer = &dev_impl->layers[layer_num - 1];
+        if (!consumed) {
+            layer->active = 0;
+            continue;
+        }
+        segled_parse_digits(line + consumed, line_len - consumed, dev_impl->num_chars, layer->digits, layer->decimal_points);
+        layer->expires_at = lifetime_ms ? ktime_add_ms(now, lifetime_ms) : 0;
+        layer->active = 1;
+    }
+    gpio_segled_next_layer_expiry(dev_impl);
+    gpio_segled_restage_text(dev_impl);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(layers);
+
+// colors attribute: the color of each digit of a color panel, in
+// hexadecimal RRGGBB form, separated by spaces (if fewer are given than
+// there are digits, the last one given is used for the rest)
+
+static ssize_t colors_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_frame* frame;
+    u32 colors[MAX_DIGITS];
+    unsigned long flags;
+    ssize_t len = 0;
+    int digit;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = dev_impl->commit_pending ? dev_impl->staged : dev_impl->shown;
+    memcpy(colors, frame->colors, dev_impl->num_digits * sizeof(*colors));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s%06x", digit ? " " : "", colors[digit]);
+    }
+    return len;
+}
+
+static ssize_t colors_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_frame* frame;
+    u32 colors[MAX_DIGITS];
+    unsigned long flags;
+    int consumed, digit = 0;
+
+    // Parse as many colors as are given, up to one per digit.
+    while (digit < dev_impl->num_digits) {
+        buf = skip_spaces(buf);
+        if (*buf == '#') {
+            ++buf;
+        }
+        if (sscanf(buf, "%x%n", &colors[digit], &consumed) != 1) {
+            break;
+        }
+        if (colors[digit] > 0xffffff) {
+            return -EINVAL;
+        }
+        buf += consumed;
+        ++digit;
+    }
+    if (!digit) {
+        return -EINVAL;
+    }
+    for (; digit < dev_impl->num_digits; ++digit) {
+        colors[digit] = colors[digit - 1];
+    }
+
+    // Redraw the digits in their new colors, to be latched at the start
+    // of the next scanning cycle.  Segments given as they are already
+    // pick their channels, so only the levels of the colors change.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = gpio_segled_begin_stage(dev_impl);
+    memcpy(frame->colors, colors, dev_impl->num_digits * sizeof(*colors));
+    if (!frame->raw_segments) {
+        gpio_segled_render(dev_impl, frame);
+    }
+    gpio_segled_finish_stage(dev_impl, 0);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(colors);
+
+// segments attribute (binary): the bitmap of segments lit for each digit,
+// bypassing the conversion from characters, as one native-endian word per
+// digit of one, two or four bytes, as the number of segments (or columns,
+// or color channels times segments) requires; reading gives the bitmaps
+// being shown, including those converted from characters
+
+/**
+ * This gives the number of bytes taken by the bitmap of segments of each
+ * digit of a panel, in the segments attribute.
+ */
+static size_t gpio_segled_segment_size(struct gpio_segled_device* dev_impl) {
+    int bits = gpio_segled_segment_bits(dev_impl);
+    if (bits <= 8) {
+        return sizeof(u8);
+    }
+    if (bits <= 16) {
+        return sizeof(u16);
+    }
+    return sizeof(u32);
+}
+
+static ssize_t segments_read(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    size_t segment_size = gpio_segled_segment_size(dev_impl);
+    size_t size = dev_impl->num_digits * segment_size;
+    u32 bitmaps[MAX_DIGITS];
+    u32 segments[MAX_DIGITS];
+    unsigned long flags;
+    int digit;
+
+    if (off >= size) {
+        return 0;
+    }
+    count = min(count, (size_t)(size - off));
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(segments, dev_impl->shown->segments, dev_impl->num_digits * sizeof(*segments));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        if (segment_size == sizeof(u8)) {
+            ((u8*)bitmaps)[digit] = segments[digit];
+        } else if (segment_size == sizeof(u16)) {
+            ((u16*)bitmaps)[digit] = segments[digit];
+        } else {
+            bitmaps[digit] = segments[digit];
+        }
+    }
+    memcpy(buf, (char*)bitmaps + off, count);
+    return count;
+}
+
+static ssize_t segments_write(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    size_t segment_size = gpio_segled_segment_size(dev_impl);
+    u32 bitmaps[MAX_DIGITS];
+    u32 segments[MAX_DIGITS];
+    unsigned long flags;
+    int digit;
+
+    // Bitmaps for all the digits must be given at once, with no bits
+    // set beyond the segments of the panel.
+    if (
+        (off != 0)
+        || (count != dev_impl->num_digits * segment_size)
+    ) {
+        return -EINVAL;
+    }
+    memcpy(bitmaps, buf, count);
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        if (segment_size == sizeof(u8)) {
+            segments[digit] = ((u8*)bitmaps)[digit];
+        } else if (segment_size == sizeof(u16)) {
+            segments[digit] = ((u16*)bitmaps)[digit];
+        } else {
+            segments[digit] = bitmaps[digit];
+        }
+        if (segments[digit] & ~gpio_segled_segment_mask(dev_impl)) {
+            return -EINVAL;
+        }
+    }
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    gpio_segled_stage_segments(dev_impl, segments, 0);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return count;
+}
+
+static const BIN_ATTR_RW(segments, 0);
+
+// map_seg7, map_seg14 and map_seg16 attributes (binary): the map used to
+// convert characters into segments, as a struct seg7_conversion_map,
+// seg14_conversion_map or seg16_conversion_map (only the one for the kind
+// of segmented LED device of the panel appears); writing a new map redraws
+// the characters shown with it
+
+static ssize_t gpio_segled_map_read(struct kobject* kobj, char* buf, loff_t off, size_t count) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    size_t size = dev_impl->bus->type->map_size;
+    unsigned long flags;
+
+    if (off >= size) {
+        return 0;
+    }
+    count = min(count, (size_t)(size - off));
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(buf, (char*)&dev_impl->map + off, count);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return count;
+}
+
+static ssize_t gpio_segled_map_write(struct kobject* kobj, char* buf, loff_t off, size_t count) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    unsigned long flags;
+
+    // The whole map must be given at once, so that it is replaced in one go.
+    if (
+        (off != 0)
+        || (count != dev_impl->bus->type->map_size)
+    ) {
+        return -EINVAL;
+    }
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    memcpy(&dev_impl->map, buf, count);
+    gpio_segled_restage_text(dev_impl);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return count;
+}
+
+static ssize_t map_seg7_read(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_read(kobj, buf, off, count);
+}
+
+static ssize_t map_seg7_write(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_write(kobj, buf, off, count);
+}
+
+static const BIN_ATTR_RW(map_seg7, sizeof(struct seg7_conversion_map));
+
+static ssize_t map_seg14_read(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_read(kobj, buf, off, count);
+}
+
+static ssize_t map_seg14_write(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_write(kobj, buf, off, count);
+}
+
+static const BIN_ATTR_RW(map_seg14, sizeof(struct seg14_conversion_map));
+
+static ssize_t map_seg16_read(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_read(kobj, buf, off, count);
+}
+
+static ssize_t map_seg16_write(struct file* file, struct kobject* kobj, const struct bin_attribute* attr, char* buf, loff_t off, size_t count) {
+    return gpio_segled_map_write(kobj, buf, off, count);
+}
+
+static const BIN_ATTR_RW(map_seg16, sizeof(struct seg16_conversion_map));
+
+// refresh attribute: desired refresh rate of the device in Hertz
+// (shared with any other panels on the same segment bus)
+
+static ssize_t refresh_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    return scnprintf(buf, PAGE_SIZE, "%lu", dev_impl->bus->refresh_rate_hz);
+}
+
+static ssize_t refresh_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    (void)sscanf(buf, "%lu", &dev_impl->bus->refresh_rate_hz);
+    return len;
+}
+
+static DEVICE_ATTR_RW(refresh);
+
+// brightness attribute: desired brightness in percent of maximum
+
+static ssize_t brightness_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    return scnprintf(buf, PAGE_SIZE, "%d", dev_impl->brightness_percent);
+}
+
+static ssize_t brightness_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    (void)sscanf(buf, "%d", &dev_impl->brightness_percent);
+    if (dev_impl->pwm) {
+        gpio_segled_apply_pwm(dev_impl, 1);
+    }
+
+    // Have the controller take the new dimming level.  The bus can't have
+    // stopped yet, since panels are deleted before their buses stop.
+    if (dev_impl->bus->ops->update) {
+        (void)schedule_work(&dev_impl->bus->update_digits_work);
+    }
+    return len;
+}
+
+static DEVICE_ATTR_RW(brightness);
+
+// digit_brightness attribute: the brightness of each digit in percent of
+// the brightness of the panel, separated by spaces (if fewer are given
+// than there are digits, the last one given is used for the rest)
+
+static ssize_t digit_brightness_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_frame* frame;
+    u8 digit_brightness[MAX_DIGITS];
+    unsigned long flags;
+    ssize_t len = 0;
+    int digit;
+
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = dev_impl->commit_pending ? dev_impl->staged : dev_impl->shown;
+    memcpy(digit_brightness, frame->digit_brightness, dev_impl->num_digits * sizeof(*digit_brightness));
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s%u", digit ? " " : "", digit_brightness[digit]);
+    }
+    return len;
+}
+
+static ssize_t digit_brightness_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_device* dev_impl = container_of(dev, struct gpio_segled_device, dev);
+    struct gpio_segled_frame* frame;
+    u8 digit_brightness[MAX_DIGITS];
+    unsigned long flags;
+    int ret;
+
+    ret = gpio_segled_parse_digit_brightness(dev_impl, buf, digit_brightness);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Have the new brightness latched at the start of the next scanning
+    // cycle, along with whatever else is staged.
+    spin_lock_irqsave(&dev_impl->bus->lock, flags);
+    frame = gpio_segled_begin_stage(dev_impl);
+    memcpy(frame->digit_brightness, digit_brightness, dev_impl->num_digits * sizeof(*digit_brightness));
+    gpio_segled_finish_stage(dev_impl, 0);
+    spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(digit_brightness);
+
+// sync_mode attribute: how to follow the external frame sync signal
+
+static ssize_t sync_mode_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_bus* bus = container_of(dev, struct gpio_segled_device, dev)->bus;
+    return scnprintf(buf, PAGE_SIZE, "%s", gpio_segled_sync_modes[bus->sync_mode]);
+}
+
+static ssize_t sync_mode_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_bus* bus = container_of(dev, struct gpio_segled_device, dev)->bus;
+    unsigned long flags;
+    int mode = sysfs_match_string(gpio_segled_sync_modes, buf);
+    if (mode < 0) {
+        return mode;
+    }
+    spin_lock_irqsave(&bus->lock, flags);
+    bus->sync_mode = mode;
+    bus->sync_lock_count = 0;
+    bus->sync_locked = 0;
+    spin_unlock_irqrestore(&bus->lock, flags);
+    return len;
+}
+
+static DEVICE_ATTR_RW(sync_mode);
+
+// sync_locked attribute: whether or not scanning is locked to the sync signal
+
+static ssize_t sync_locked_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_bus* bus = container_of(dev, struct gpio_segled_device, dev)->bus;
+    return scnprintf(buf, PAGE_SIZE, "%d", bus->sync_locked);
+}
+
+static DEVICE_ATTR_RO(sync_locked);
+
+// sync_phase_error attribute: last measured offset of the start of the
+// scanning cycle from the sync signal, in nanoseconds (positive is late)
+
+static ssize_t sync_phase_error_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_bus* bus = container_of(dev, struct gpio_segled_device, dev)->bus;
+    unsigned long flags;
+    s64 phase_error_ns;
+    spin_lock_irqsave(&bus->lock, flags);
+    phase_error_ns = bus->sync_phase_error_ns;
+    spin_unlock_irqrestore(&bus->lock, flags);
+    return scnprintf(buf, PAGE_SIZE, "%lld", phase_error_ns);
+}
+
+static DEVICE_ATTR_RO(sync_phase_error);
+
+// sync_period attribute: measured period of the sync signal in nanoseconds
+
+static ssize_t sync_period_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_bus* bus = container_of(dev, struct gpio_segled_device, dev)->bus;
+    unsigned long flags;
+    u64 period_ns;
+    spin_lock_irqsave(&bus->lock, flags);
+    period_ns = bus->sync_period_ns;
+    spin_unlock_irqrestore(&bus->lock, flags);
+    return scnprintf(buf, PAGE_SIZE, "%llu", period_ns);
+}
+
+static DEVICE_ATTR_RO(sync_period);
+
+// attribute groups
+
+static struct attribute* gpio_segled_attrs[] = {
+    &dev_attr_digits.attr,
+    &dev_attr_frame.attr,
+    &dev_attr_queue.attr,
+    &dev_attr_queue_underruns.attr,
+    &dev_attr_message.attr,
+    &dev_attr_scroll_step_ms.attr,
+    &dev_attr_blink.attr,
+    &dev_attr_digit_blink.attr,
+    &dev_attr_fade_ms.attr,
+    &dev_attr_layers.attr,
+    &dev_attr_refresh.attr,
+    &dev_attr_brightness.attr,
+    &dev_attr_digit_brightness.attr,
+    NULL
+};
+
+static const struct bin_attribute* const gpio_segled_bin_attrs[] = {
+    &bin_attr_segments,
+    NULL
+};
+
+static const struct attribute_group gpio_segled_attr_group = {
+    .attrs = gpio_segled_attrs,
+    .GPIO_SEGLED_BIN_ATTRS = gpio_segled_bin_attrs,
+};
+
+static struct attribute* gpio_segled_sync_attrs[] = {
+    &dev_attr_sync_mode.attr,
+    &dev_attr_sync_locked.attr,
+    &dev_attr_sync_phase_error.attr,
+    &dev_attr_sync_period.attr,
+    NULL
+};
+
+// The sync attributes only appear for panels on a bus with a sync GPIO.
+static umode_t gpio_segled_sync_attrs_visible(struct kobject* kobj, struct attribute* attr, int n) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    return dev_impl->bus->sync_gpio ? attr->mode : 0;
+}
+
+static const struct attribute_group gpio_segled_sync_attr_group = {
+    .attrs = gpio_segled_sync_attrs,
+    .is_visible = gpio_segled_sync_attrs_visible,
+};
+
+static struct attribute* gpio_segled_color_attrs[] = {
+    &dev_attr_colors.attr,
+    NULL
+};
+
+// The color attributes only appear for color panels.
+static umode_t gpio_segled_color_attrs_visible(struct kobject* kobj, struct attribute* attr, int n) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    return (dev_impl->bus->channels > 1) ? attr->mode : 0;
+}
+
+static const struct attribute_group gpio_segled_color_attr_group = {
+    .attrs = gpio_segled_color_attrs,
+    .is_visible = gpio_segled_color_attrs_visible,
+};
+
+static const struct bin_attribute* const gpio_segled_map_bin_attrs[] = {
+    &bin_attr_map_seg7,
+    &bin_attr_map_seg14,
+    &bin_attr_map_seg16,
+    NULL
+};
+
+// Only the map attribute for the kind of segmented LED device of the
+// panel appears, and none for dot-matrix panels.
+static umode_t gpio_segled_map_bin_attrs_visible(struct kobject* kobj, const struct bin_attribute* attr, int n) {
+    struct gpio_segled_device* dev_impl = container_of(kobj_to_dev(kobj), struct gpio_segled_device, dev);
+    static const int segments[] = { 7, 14, 16 };
+    if (
+        !dev_impl->bus->type
+        || (dev_impl->bus->type->segments != segments[n])
+    ) {
+        return 0;
+    }
+    return attr->attr.mode;
+}
+
+static const struct attribute_group gpio_segled_map_attr_group = {
+    .GPIO_SEGLED_BIN_ATTRS = gpio_segled_map_bin_attrs,
+    .is_bin_visible = gpio_segled_map_bin_attrs_visible,
 };
 
 static const struct attribute_group* gpio_segled_attr_groups[] = {
     &gpio_segled_attr_group,
+    &gpio_segled_sync_attr_group,
+    &gpio_segled_color_attr_group,
+    &gpio_segled_map_attr_group,
+    NULL
+};
+
+// character device: writing shows characters, as for the digits attribute,
+// reading (or polling) waits for a new frame to be fully scanned out, and
+// mapping shares a page through which to publish frames without syscalls
+
+/**
+ * These are the numbers in the names of the character devices of panels,
+ * across all instances of the driver.
+ */
+static DEFINE_IDA(gpio_segled_ida);
+
+/**
+ * This is the state of an open character device of a panel: the number of
+ * frames the panel had shown when they were last read.
+ */
+struct gpio_segled_file {
+    struct gpio_segled_device* dev_impl;
+    u64 frames_read;
+};
+
+/**
+ * This tells whether or not there is a new frame for an open character
+ * device to read, or the panel has gone away.
+ */
+static int gpio_segled_file_ready(struct gpio_segled_file* f) {
+    struct gpio_segled_device* dev_impl = f->dev_impl;
+    unsigned long flags;
+    int ready;
+
+    spin_lock_irqsave(&dev_impl->shown_lock, flags);
+    ready = (dev_impl->frames_shown != f->frames_read);
+    spin_unlock_irqrestore(&dev_impl->shown_lock, flags);
+    return ready || READ_ONCE(dev_impl->misc_gone);
+}
+
+static int gpio_segled_file_open(struct inode* inode, struct file* file) {
+    struct gpio_segled_device* dev_impl = container_of(file->private_data, struct gpio_segled_device, misc);
+    struct gpio_segled_file* f;
+    unsigned long flags;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f) {
+        return -ENOMEM;
+    }
+
+    // Hold on to the panel for as long as the file is open, and only
+    // report frames shown from now on.
+    f->dev_impl = dev_impl;
+    get_device(&dev_impl->dev);
+    spin_lock_irqsave(&dev_impl->shown_lock, flags);
+    f->frames_read = dev_impl->frames_shown;
+    spin_unlock_irqrestore(&dev_impl->shown_lock, flags);
+    file->private_data = f;
+    return nonseekable_open(inode, file);
+}
+
+static int gpio_segled_file_release(struct inode* inode, struct file* file) {
+    struct gpio_segled_file* f = file->private_data;
+    put_device(&f->dev_impl->dev);
+    kfree(f);
+    return 0;
+}
+
+static ssize_t gpio_segled_file_write(struct file* file, const char __user* buf, size_t len, loff_t* ppos) {
+    struct gpio_segled_file* f = file->private_data;
+    struct gpio_segled_device* dev_impl = f->dev_impl;
+    char* digits;
+    int ret;
+
+    // Frames are only ever staged, replacing any not yet latched, so
+    // writing never waits.
+    digits = memdup_user_nul(buf, min_t(size_t, len, PAGE_SIZE));
+    if (IS_ERR(digits)) {
+        return PTR_ERR(digits);
+    }
+    mutex_lock(&dev_impl->misc_lock);
+    ret = dev_impl->misc_gone ? -ENODEV : gpio_segled_store_digits(dev_impl, digits, strlen(digits));
+    mutex_unlock(&dev_impl->misc_lock);
+    kfree(digits);
+    return ret ? ret : len;
+}
+
+static ssize_t gpio_segled_file_read(struct file* file, char __user* buf, size_t len, loff_t* ppos) {
+    struct gpio_segled_file* f = file->private_data;
+    struct gpio_segled_device* dev_impl = f->dev_impl;
+    struct segled_frame_event event;
+    unsigned long flags;
+    int ret;
+
+    if (len < sizeof(event)) {
+        return -EINVAL;
+    }
+
+    // Wait for a frame not yet read to be fully scanned out, unless
+    // opened non-blocking.  Frames shown in the meantime are skipped,
+    // as the sequence number read shows.
+    if (!gpio_segled_file_ready(f)) {
+        if (file->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+        ret = wait_event_interruptible(dev_impl->shown_wait, gpio_segled_file_ready(f));
+        if (ret) {
+            return ret;
+        }
+    }
+    if (READ_ONCE(dev_impl->misc_gone)) {
+        return -ENODEV;
+    }
+    spin_lock_irqsave(&dev_impl->shown_lock, flags);
+    event.sequence = dev_impl->frames_shown;
+    event.time_ns = ktime_to_ns(dev_impl->shown_at);
+    spin_unlock_irqrestore(&dev_impl->shown_lock, flags);
+    f->frames_read = event.sequence;
+    if (copy_to_user(buf, &event, sizeof(event))) {
+        return -EFAULT;
+    }
+    return sizeof(event);
+}
+
+/**
+ * This maps the page through which a panel shares frames with userspace
+ * (see struct segled_shared_frame), setting it up on first use with the
+ * frame and brightness the panel has.  Backends which do their own
+ * scanning have no scanning cycle to take frames from it at.
+ */
+static int gpio_segled_file_mmap(struct file* file, struct vm_area_struct* vma) {
+    struct gpio_segled_file* f = file->private_data;
+    struct gpio_segled_device* dev_impl = f->dev_impl;
+    struct segled_shared_frame* shared;
+    struct gpio_segled_frame* frame;
+    unsigned long flags;
+    int ret = 0;
+
+    if (
+        vma->vm_pgoff
+        || (vma->vm_end - vma->vm_start > PAGE_SIZE)
+        || !(vma->vm_flags & VM_SHARED)
+    ) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&dev_impl->misc_lock);
+    if (dev_impl->misc_gone) {
+        ret = -ENODEV;
+    } else if (dev_impl->bus->ops->update) {
+        ret = -EOPNOTSUPP;
+    } else if (!dev_impl->shared) {
+        shared = (struct segled_shared_frame*)get_zeroed_page(GFP_KERNEL);
+        if (!shared) {
+            ret = -ENOMEM;
+        } else {
+            spin_lock_irqsave(&dev_impl->bus->lock, flags);
+            frame = dev_impl->commit_pending ? dev_impl->staged : dev_impl->shown;
+            shared->num_digits = min(dev_impl->num_digits, SEGLED_SHARED_MAX_DIGITS);
+            shared->brightness_percent = clamp(dev_impl->brightness_percent, 0, 100);
+            memcpy(shared->segments, frame->segments, shared->num_digits * sizeof(*shared->segments));
+            dev_impl->shared_sequence = 0;
+            dev_impl->shared = shared;
+            spin_unlock_irqrestore(&dev_impl->bus->lock, flags);
+        }
+    }
+    if (!ret) {
+        ret = vm_insert_page(vma, vma->vm_start, virt_to_page(dev_impl->shared));
+    }
+    mutex_unlock(&dev_impl->misc_lock);
+    return ret;
+}
+
+static __poll_t gpio_segled_file_poll(struct file* file, struct poll_table_struct* wait) {
+    struct gpio_segled_file* f = file->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &f->dev_impl->shown_wait, wait);
+    if (gpio_segled_file_ready(f)) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    return mask;
+}
+
+static const struct file_operations gpio_segled_fops = {
+    .owner = THIS_MODULE,
+    .open = gpio_segled_file_open,
+    .release = gpio_segled_file_release,
+    .write = gpio_segled_file_write,
+    .read = gpio_segled_file_read,
+    .poll = gpio_segled_file_poll,
+    .mmap = gpio_segled_file_mmap,
+};
+
+/**
+ * This registers the character device of a panel, as "/dev/segledN".
+ */
+static int gpio_segled_misc_add(struct gpio_segled_device* dev_impl) {
+    int id, ret;
+
+    id = ida_alloc(&gpio_segled_ida, GFP_KERNEL);
+    if (id < 0) {
+        return id;
+    }
+    (void)snprintf(dev_impl->misc_name, sizeof(dev_impl->misc_name), "segled%d", id);
+    dev_impl->misc.minor = MISC_DYNAMIC_MINOR;
+    dev_impl->misc.name = dev_impl->misc_name;
+    dev_impl->misc.fops = &gpio_segled_fops;
+    dev_impl->misc.parent = &dev_impl->dev;
+    ret = misc_register(&dev_impl->misc);
+    if (ret) {
+        pr_err("unable to register %s character device: error code %d\n", dev_name(&dev_impl->dev), ret);
+        ida_free(&gpio_segled_ida, id);
+        return ret;
+    }
+    dev_impl->misc_id = id;
+    return 0;
+}
+
+/**
+ * This unregisters the character device of a panel, ahead of its bus
+ * being stopped.  Files still open on it then fail with ENODEV, and any
+ * readers waiting on it are woken up.
+ */
+static void gpio_segled_misc_remove(struct gpio_segled_device* dev_impl) {
+    if (dev_impl->misc_id < 0) {
+        return;
+    }
+    misc_deregister(&dev_impl->misc);
+    mutex_lock(&dev_impl->misc_lock);
+    dev_impl->misc_gone = 1;
+    mutex_unlock(&dev_impl->misc_lock);
+    wake_up_interruptible_all(&dev_impl->shown_wait);
+    ida_free(&gpio_segled_ida, dev_impl->misc_id);
+    dev_impl->misc_id = -1;
+}
+
+/**
+ * This is called by the kernel whenever a virtual display is removed.
+ */
+static void gpio_segled_virtual_release(struct device* dev) {
+    struct gpio_segled_virtual* vdev = container_of(dev, struct gpio_segled_virtual, dev);
+    int panel;
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        put_device(&vdev->panels[panel]->dev);
+    }
+    pr_info("device removed: %s\n", dev_name(dev));
+    kfree(vdev);
+}
+
+/**
+ * This tells whether or not a panel of a virtual display is the first
+ * one of the display on its segment bus.
+ */
+static int gpio_segled_virtual_first_on_bus(struct gpio_segled_virtual* vdev, int panel) {
+    int other;
+    for (other = 0; other < panel; ++other) {
+        if (vdev->panels[other]->bus == vdev->panels[panel]->bus) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * This restarts the scanning timers of the segment buses of the panels
+ * of a virtual display together, so that their scanning cycles begin at
+ * the same moments and a frame staged on all of them is latched by all
+ * of them at once.
+ *
+ * It is only called while the virtual display is registered, and virtual
+ * displays are deleted before the buses of their panels stop, so the
+ * timers restarted here are never those of stopped buses.
+ */
+static void gpio_segled_virtual_align(struct gpio_segled_virtual* vdev) {
+    struct gpio_segled_bus* bus;
+    unsigned long flags;
+    ktime_t start;
+    int panel;
+
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        (void)hrtimer_cancel(&vdev->panels[panel]->bus->digit_timer);
+    }
+    start = ktime_get();
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        if (!gpio_segled_virtual_first_on_bus(vdev, panel)) {
+            continue;
+        }
+        bus = vdev->panels[panel]->bus;
+        spin_lock_irqsave(&bus->lock, flags);
+        gpio_segled_bus_rewind(bus);
+        spin_unlock_irqrestore(&bus->lock, flags);
+        hrtimer_start(&bus->digit_timer, start, HRTIMER_MODE_ABS);
+    }
+}
+
+// virtual display digits attribute: the characters to show across all
+// panels of the display
+
+static ssize_t virtual_digits_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_virtual* vdev = container_of(dev, struct gpio_segled_virtual, dev);
+    struct gpio_segled_device* dev_impl;
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    ssize_t len = 0;
+    int panel;
+
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        dev_impl = vdev->panels[panel];
+        gpio_segled_get_digits(dev_impl, digits, decimal_points);
+        len = gpio_segled_format_digits(buf, len, dev_impl->num_chars, digits, decimal_points);
+    }
+    return len;
+}
+
+static ssize_t virtual_digits_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_virtual* vdev = container_of(dev, struct gpio_segled_virtual, dev);
+    struct gpio_segled_device* dev_impl;
+    struct gpio_segled_bus* bus = vdev->panels[0]->bus;
+    char* digits;
+    int* decimal_points;
+    unsigned long flags;
+    ktime_t commit_at, deadline;
+    u64 cycle_ns;
+    int panel, offset = 0;
+
+    // Parse the new digits once for the whole display.
+    digits = kcalloc(vdev->num_chars, sizeof(*digits), GFP_KERNEL);
+    decimal_points = kcalloc(vdev->num_chars, sizeof(*decimal_points), GFP_KERNEL);
+    if (
+        !digits
+        || !decimal_points
+    ) {
+        kfree(decimal_points);
+        kfree(digits);
+        return -ENOMEM;
+    }
+    segled_parse_digits(buf, len, vdev->num_chars, digits, decimal_points);
+
+    // Stage each panel's share of the digits, replacing any message
+    // scrolling on it, to be latched by all panels at the first common
+    // cycle boundary far enough ahead that staging will be done by then.
+    // Interrupts stay off so nothing can get in between staging the first
+    // panel and the last.
+    local_irq_save(flags);
+    spin_lock(&bus->lock);
+    commit_at = ktime_add_ns(bus->cycle_start, bus->cycle_ns);
+    cycle_ns = bus->cycle_ns;
+    spin_unlock(&bus->lock);
+    deadline = ktime_add_ns(ktime_get(), COMMIT_GUARD_NS);
+    if (
+        cycle_ns
+        && ktime_before(commit_at, deadline)
+    ) {
+        commit_at = ktime_add_ns(commit_at, cycle_ns * div64_u64(ktime_to_ns(ktime_sub(deadline, commit_at)) + cycle_ns - 1, cycle_ns));
+    }
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        dev_impl = vdev->panels[panel];
+        spin_lock(&dev_impl->bus->lock);
+        dev_impl->message_len = 0;
+        gpio_segled_stage_digits(dev_impl, digits + offset, decimal_points + offset, NULL, commit_at);
+        spin_unlock(&dev_impl->bus->lock);
+        offset += dev_impl->num_chars;
+    }
+    local_irq_restore(flags);
+
+    kfree(decimal_points);
+    kfree(digits);
+    return len;
+}
+
+static struct device_attribute dev_attr_virtual_digits = __ATTR(digits, 0644, virtual_digits_show, virtual_digits_store);
+
+// virtual display refresh attribute: desired refresh rate of all panels
+// of the display in Hertz
+
+static ssize_t virtual_refresh_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    struct gpio_segled_virtual* vdev = container_of(dev, struct gpio_segled_virtual, dev);
+    return scnprintf(buf, PAGE_SIZE, "%lu", vdev->panels[0]->bus->refresh_rate_hz);
+}
+
+static ssize_t virtual_refresh_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    struct gpio_segled_virtual* vdev = container_of(dev, struct gpio_segled_virtual, dev);
+    unsigned long refresh_rate_hz = vdev->panels[0]->bus->refresh_rate_hz;
+    int panel;
+
+    // Panels must scan at the same rate in order to share cycle
+    // boundaries, so change them all and then bring them back in step.
+    (void)sscanf(buf, "%lu", &refresh_rate_hz);
+    for (panel = 0; panel < vdev->num_panels; ++panel) {
+        vdev->panels[panel]->bus->refresh_rate_hz = refresh_rate_hz;
+    }
+    gpio_segled_virtual_align(vdev);
+    return len;
+}
+
+static struct device_attribute dev_attr_virtual_refresh = __ATTR(refresh, 0644, virtual_refresh_show, virtual_refresh_store);
+
+// virtual display attribute groups
+
+static struct attribute* gpio_segled_virtual_attrs[] = {
+    &dev_attr_virtual_digits.attr,
+    &dev_attr_virtual_refresh.attr,
     NULL
 };
 
+static const struct attribute_group gpio_segled_virtual_attr_group = {
+    .attrs = gpio_segled_virtual_attrs,
+};
+
+static const struct attribute_group* gpio_segled_virtual_attr_groups[] = {
+    &gpio_segled_virtual_attr_group,
+    NULL
+};
+
+/**
+ * This is the state structure for the overall device driver.
+ */
+struct gpio_segled_driver {
+    /**
+     * This is the number of devices registered with the kernel.
+     */
+    int num_devices;
+
+    /**
+     * This is the number of devices registered with the kernel which
+     * are LED panels.  These come first, ahead of any virtual displays.
+     */
+    int num_panels;
+
+    /**
+     * These are the segment buses set up for the panels, and how
+     * many there are.
+     */
+    int num_buses;
+    struct gpio_segled_bus** buses;
+
+    /**
+     * This is the debugfs directory holding the records of simulated
+     * panels, if there are any.
+     */
+    struct dentry* debugfs;
+
+    /**
+     * These are the pointers to the individual devices registered
+     * with the kernel.
+     */
+    struct device* devices[];
+};
+
+/**
+ * This counts the digit GPIOs ("d1", "d2", ..., or "r1", "r2", ... for the
+ * rows of a dot-matrix panel) listed for a device in the device tree,
+ * stopping at the first one missing.
+ */
+static int gpio_segled_count_digits(struct fwnode_handle* child, const char* prefix) {
+    char prop[16];
+    int count;
+
+    for (count = 0; count < MAX_DIGITS; ++count) {
+        (void)snprintf(prop, sizeof(prop), "%s%d-gpios", prefix, count + 1);
+        if (fwnode_property_present(child, prop)) {
+            continue;
+        }
+        (void)snprintf(prop, sizeof(prop), "%s%d-gpio", prefix, count + 1);
+        if (!fwnode_property_present(child, prop)) {
+            break;
+        }
+    }
+    return count;
+}
+
+/**
+ * This looks up which GPIO line is listed for a device in the device tree
+ * under the given consumer identifier, without reserving it.
+ */
+static int gpio_segled_get_gpio_ref(struct fwnode_handle* child, const char* con_id, struct fwnode_reference_args* ref) {
+    char prop[16];
+    int ret;
+
+    (void)snprintf(prop, sizeof(prop), "%s-gpios", con_id);
+    ret = fwnode_property_get_reference_args(child, prop, "#gpio-cells", 0, 0, ref);
+    if (ret == -ENOENT) {
+        (void)snprintf(prop, sizeof(prop), "%s-gpio", con_id);
+        ret = fwnode_property_get_reference_args(child, prop, "#gpio-cells", 0, 0, ref);
+    }
+
+    // Only the identity of the GPIO controller is needed, to compare
+    // against other references, so the controller node isn't kept.
+    if (!ret) {
+        fwnode_handle_put(ref->fwnode);
+    }
+    return ret;
+}
+
+/**
+ * This tells whether or not two GPIO references are to the same line.
+ * The first cell of a GPIO specifier selects the line on the controller;
+ * any others are flags.
+ */
+static int gpio_segled_same_gpio(const struct fwnode_reference_args* a, const struct fwnode_reference_args* b) {
+    return (
+        (a->fwnode == b->fwnode)
+        && (a->nargs > 0)
+        && (b->nargs > 0)
+        && (a->args[0] == b->args[0])
+    );
+}
+
+/**
+ * This looks up the kind of segmented device a panel is, from the number
+ * of segments given in the device tree ("segments"), assuming seven
+ * segments if none is given.
+ */
+static const struct gpio_segled_segment_type* gpio_segled_get_segment_type(struct fwnode_handle* child) {
+    u32 segments = 7;
+    int index;
+
+    (void)fwnode_property_read_u32(child, "segments", &segments);
+    for (index = 0; index < ARRAY_SIZE(gpio_segled_segment_types); ++index) {
+        if (gpio_segled_segment_types[index].segments == segments) {
+            return &gpio_segled_segment_types[index];
+        }
+    }
+    pr_err("unsupported number of segments: %u\n", segments);
+    return ERR_PTR(-EINVAL);
+}
+
+/**
+ * This sets up a new bus, with enough space to fit as many panel pointers
+ * as there could be panels.  Scanning starts once all the panels on it
+ * are known.
+ */
+static struct gpio_segled_bus* gpio_segled_new_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, const struct segled_backend_ops* ops, int max_panels) {
+    struct gpio_segled_bus* bus;
+
+    bus = devm_kzalloc(&pdev->dev, sizeof(*bus) + sizeof(*bus->panels) * max_panels, GFP_KERNEL);
+    if (!bus) {
+        return ERR_PTR(-ENOMEM);
+    }
+    bus->ops = ops;
+    bus->channels = 1;
+    spin_lock_init(&bus->lock);
+    INIT_WORK(&bus->update_digits_work, execute_update_digits);
+    hrtimer_setup(&bus->digit_timer, gpio_segled_digit_timer_tick, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    drv->buses[drv->num_buses++] = bus;
+    return bus;
+}
+
+/**
+ * This finds the segment bus made up of the segment GPIOs listed for a
+ * panel in the device tree, setting up a new bus if no panel seen so far
+ * shares them.  Panels must share either all of their segment GPIOs or
+ * none of them.
+ */
+static struct gpio_segled_bus* gpio_segled_get_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels) {
+    struct fwnode_reference_args refs[MAX_SEGMENT_GPIOS];
+    const struct gpio_segled_segment_type* type = NULL;
+    struct gpio_segled_bus* bus;
+    const char** consumers;
+    u32 columns;
+    int channels = 1;
+    int num_gpios;
+    int gpio, channel, index, shared, ret;
+
+    // Find out what kind of device the panel is.  It is a dot-matrix panel
+    // if the device tree gives a number of columns, with column GPIOs
+    // "c1", "c2", and so on.  Otherwise it is a segmented device, assumed
+    // to be seven-segment unless the device tree says otherwise.
+    if (!fwnode_property_read_u32(child, "columns", &columns)) {
+        if (
+            (columns < 1)
+            || (columns > MAX_SEGMENT_GPIOS)
+        ) {
+            pr_err("unsupported number of columns: %u\n", columns);
+            return ERR_PTR(-EINVAL);
+        }
+        num_gpios = columns;
+        consumers = devm_kcalloc(&pdev->dev, num_gpios, sizeof(*consumers), GFP_KERNEL);
+        if (!consumers) {
+            return ERR_PTR(-ENOMEM);
+        }
+        for (gpio = 0; gpio < num_gpios; ++gpio) {
+            consumers[gpio] = devm_kasprintf(&pdev->dev, GFP_KERNEL, "c%d", gpio + 1);
+            if (!consumers[gpio]) {
+                return ERR_PTR(-ENOMEM);
+            }
+        }
+    } else {
+        type = gpio_segled_get_segment_type(child);
+        if (IS_ERR(type)) {
+            return ERR_CAST(type);
+        }
+        num_gpios = type->num_gpios;
+        consumers = type->consumers;
+
+        // Color panels have a full set of segment GPIOs for each channel,
+        // named after the segment and the channel, all of which must fit
+        // in a segment bitmap.
+        if (fwnode_property_present(child, "rgb")) {
+            channels = NUM_COLOR_CHANNELS;
+            num_gpios = type->num_gpios * channels;
+            if (num_gpios > MAX_SEGMENT_GPIOS) {
+                pr_err("color is not supported for %d-segment devices\n", type->segments);
+                return ERR_PTR(-EINVAL);
+            }
+            consumers = devm_kcalloc(&pdev->dev, num_gpios, sizeof(*consumers), GFP_KERNEL);
+            if (!consumers) {
+                return ERR_PTR(-ENOMEM);
+            }
+            for (channel = 0; channel < channels; ++channel) {
+                for (gpio = 0; gpio < type->num_gpios; ++gpio) {
+                    consumers[channel * type->num_gpios + gpio] = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%s-%s", type->consumers[gpio], gpio_segled_channel_names[channel]);
+                    if (!consumers[channel * type->num_gpios + gpio]) {
+                        return ERR_PTR(-ENOMEM);
+                    }
+                }
+            }
+        }
+    }
+
+    // Find out which lines the segment GPIOs are.
+    for (gpio = 0; gpio < num_gpios; ++gpio) {
+        ret = gpio_segled_get_gpio_ref(child, consumers[gpio], &refs[gpio]);
+        if (ret) {
+            pr_err("unable to look up %s GPIO: error code %d\n", consumers[gpio], ret);
+            return ERR_PTR(ret);
+        }
+    }
+
+    // Join the bus already using the same lines, if there is one.
+    for (index = 0; index < drv->num_buses; ++index) {
+        bus = drv->buses[index];
+        shared = 0;
+        for (gpio = 0; gpio < min(num_gpios, bus->num_gpios); ++gpio) {
+            if (gpio_segled_same_gpio(&refs[gpio], &bus->segment_refs[gpio])) {
+                ++shared;
+            }
+        }
+        if (
+            (shared == num_gpios)
+            && (bus->num_gpios == num_gpios)
+            && (bus->type == type)
+            && (bus->channels == channels)
+            && (bus->ops == ops)
+        ) {
+            return bus;
+        }
+        if (shared) {
+            pr_err("panel shares only some of its segment GPIOs with another panel\n");
+            return ERR_PTR(-EBUSY);
+        }
+    }
+
+    // Otherwise set up a new bus.
+    bus = gpio_segled_new_bus(pdev, drv, ops, max_panels);
+    if (IS_ERR(bus)) {
+        return bus;
+    }
+    memcpy(bus->segment_refs, refs, sizeof(refs));
+    bus->type = type;
+    bus->channels = channels;
+    bus->num_gpios = num_gpios;
+    bus->consumers = consumers;
+    bus->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+
+    // Attempt to reserve and configure the segment GPIOs.
+    for (gpio = 0; gpio < num_gpios; ++gpio) {
+        bus->gpios[gpio] = devm_fwnode_gpiod_get(&pdev->dev, child, consumers[gpio], GPIOD_OUT_LOW, consumers[gpio]);
+        if (IS_ERR(bus->gpios[gpio])) {
+            ret = PTR_ERR(bus->gpios[gpio]);
+            pr_err("unable to get %s GPIO: error code %d\n", consumers[gpio], ret);
+            return ERR_PTR(ret);
+        }
+    }
+    return bus;
+}
+
+/**
+ * This reserves and configures the digit GPIOs listed for a panel in the
+ * device tree ("d1", "d2", ..., or "r1", "r2", ... for the rows of a
+ * dot-matrix panel), after those of any other panels on its bus.
+ */
+static int gpio_segled_get_digit_gpios(struct platform_device* pdev, struct gpio_segled_device* dev_impl, struct fwnode_handle* child) {
+    struct gpio_segled_bus* bus = dev_impl->bus;
+    struct gpio_desc** digit_gpios = &bus->gpios[bus->num_gpios + dev_impl->digit_base];
+    const char* digit_prefix = bus->type ? "d" : "r";
+    const char* digit_name;
+    int digit, ret;
+
+    dev_impl->num_digits = gpio_segled_count_digits(child, digit_prefix);
+    if (!dev_impl->num_digits) {
+        pr_err("no %s1 GPIO given for %s\n", digit_prefix, to_of_node(child)->name);
+        return -EINVAL;
+    }
+    if (dev_impl->digit_base + dev_impl->num_digits > MAX_BUS_DIGITS) {
+        pr_err("too many digits sharing the same segment GPIOs\n");
+        return -EINVAL;
+    }
+    for (digit = 0; digit < dev_impl->num_digits; ++digit) {
+        digit_name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%s%d", digit_prefix, digit + 1);
+        if (!digit_name) {
+            return -ENOMEM;
+        }
+        digit_gpios[digit] = devm_fwnode_gpiod_get(&pdev->dev, child, digit_name, GPIOD_OUT_LOW, digit_name);
+        if (IS_ERR(digit_gpios[digit])) {
+            ret = PTR_ERR(digit_gpios[digit]);
+            pr_err("unable to get %s GPIO: error code %d\n", digit_name, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This sets up the bus of a charlieplexed panel, which drives all of its
+ * LEDs through the pins listed for it in the device tree ("p1", "p2", ...),
+ * and so doesn't share them with any other panel.  The pins start out as
+ * inputs, with all LEDs off.
+ */
+static struct gpio_segled_bus* gpio_segled_get_charlieplex_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels) {
+    const struct gpio_segled_segment_type* type;
+    struct gpio_segled_bus* bus;
+    const char* pin_name;
+    int num_pins, pin, ret;
+
+    // Find out what kind of segmented device the panel is.
+    type = gpio_segled_get_segment_type(child);
+    if (IS_ERR(type)) {
+        return ERR_CAST(type);
+    }
+    num_pins = gpio_segled_count_digits(child, "p");
+    if (
+        (num_pins < 2)
+        || (num_pins > MAX_SEGMENT_GPIOS)
+    ) {
+        pr_err("unsupported number of charlieplexed pins: %d\n", num_pins);
+        return ERR_PTR(-EINVAL);
+    }
+
+    bus = gpio_segled_new_bus(pdev, drv, ops, max_panels);
+    if (IS_ERR(bus)) {
+        return bus;
+    }
+    bus->type = type;
+    bus->charlieplex = 1;
+    bus->num_gpios = num_pins;
+    bus->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+
+    // Attempt to reserve and configure the pins.
+    for (pin = 0; pin < num_pins; ++pin) {
+        pin_name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "p%d", pin + 1);
+        if (!pin_name) {
+            return ERR_PTR(-ENOMEM);
+        }
+        bus->gpios[pin] = devm_fwnode_gpiod_get(&pdev->dev, child, pin_name, GPIOD_IN, pin_name);
+        if (IS_ERR(bus->gpios[pin])) {
+            ret = PTR_ERR(bus->gpios[pin]);
+            pr_err("unable to get %s GPIO: error code %d\n", pin_name, ret);
+            return ERR_PTR(ret);
+        }
+    }
+    return bus;
+}
+
+/**
+ * These are the external identifiers of the GPIOs driving a chain of
+ * shift registers, in the order they are reserved.
+ */
+static const char* gpio_segled_shift_consumers[] = {
+    "data",
+    "clock",
+    "latch",
+};
+
 /**
- * This is the state structure for the overall device driver.
+ * This sets up the bus of a panel driven through a chain of 74HC595 (or
+ * similar) shift registers, which take the segments on their first outputs
+ * and the digit commons on the outputs after them, and so needs only a
+ * data, clock and latch GPIO however many digits the panel has.  The
+ * number of digits is given in the device tree ("digits"), as are which
+ * outputs are active-low ("segments-active-low", "digits-active-low").
+ * The panel has the bus to itself, and starts out with all LEDs off.
  */
-struct gpio_segled_driver {
-    /**
-     * This is the number of devices registered with the kernel.
-     */
-    int num_devices;
+static struct gpio_segled_bus* gpio_segled_get_shift_register_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels) {
+    const struct gpio_segled_segment_type* type;
+    struct gpio_segled_bus* bus;
+    struct gpio_desc** gpios[ARRAY_SIZE(gpio_segled_shift_consumers)];
+    u32 digits = 0;
+    int gpio, ret;
 
-    /**
-     * These are the pointers to the individual devices registered
-     * with the kernel.
-     */
-    struct gpio_segled_device* devices[];
+    // Find out what kind of segmented device the panel is, and make sure
+    // its segments and digits fit in the registers that can be shifted.
+    type = gpio_segled_get_segment_type(child);
+    if (IS_ERR(type)) {
+        return ERR_CAST(type);
+    }
+    (void)fwnode_property_read_u32(child, "digits", &digits);
+    if (
+        (digits < 1)
+        || (type->num_gpios + digits > MAX_SEGMENT_GPIOS)
+    ) {
+        pr_err("unsupported number of shift register digits: %u\n", digits);
+        return ERR_PTR(-EINVAL);
+    }
+
+    bus = gpio_segled_new_bus(pdev, drv, ops, max_panels);
+    if (IS_ERR(bus)) {
+        return bus;
+    }
+    bus->type = type;
+    bus->channels = 1;
+    bus->num_gpios = type->num_gpios;
+    bus->consumers = type->consumers;
+    bus->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+    bus->shift_bits = DIV_ROUND_UP(type->num_gpios + digits, 8) * 8;
+    if (fwnode_property_read_bool(child, "segments-active-low")) {
+        bus->shift_invert |= BIT(type->num_gpios) - 1;
+    }
+    if (fwnode_property_read_bool(child, "digits-active-low")) {
+        bus->shift_invert |= (BIT(digits) - 1) << type->num_gpios;
+    }
+
+    // Attempt to reserve and configure the shift register GPIOs.
+    gpios[0] = &bus->shift_data;
+    gpios[1] = &bus->shift_clock;
+    gpios[2] = &bus->shift_latch;
+    for (gpio = 0; gpio < ARRAY_SIZE(gpio_segled_shift_consumers); ++gpio) {
+        *gpios[gpio] = devm_fwnode_gpiod_get(&pdev->dev, child, gpio_segled_shift_consumers[gpio], GPIOD_OUT_LOW, gpio_segled_shift_consumers[gpio]);
+        if (IS_ERR(*gpios[gpio])) {
+            ret = PTR_ERR(*gpios[gpio]);
+            pr_err("unable to get %s GPIO: error code %d\n", gpio_segled_shift_consumers[gpio], ret);
+            return ERR_PTR(ret);
+        }
+    }
+
+    // Turn all the outputs off.
+    bus->cansleep = ops->cansleep(bus);
+    gpio_segled_shift_out(bus, bus->shift_invert);
+    return bus;
+}
+
+/**
+ * This sets up the bus of a simulated panel, which has no GPIOs at all,
+ * only a record of the most recent slots of its scanning cycle, for
+ * trying out the driver on machines without any LEDs.  The number of
+ * digits is given in the device tree ("digits").  The panel has the
+ * bus to itself.
+ */
+static struct gpio_segled_bus* gpio_segled_get_simulated_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels) {
+    const struct gpio_segled_segment_type* type;
+    struct gpio_segled_bus* bus;
+    u32 digits = 0;
+
+    type = gpio_segled_get_segment_type(child);
+    if (IS_ERR(type)) {
+        return ERR_CAST(type);
+    }
+    (void)fwnode_property_read_u32(child, "digits", &digits);
+    if (
+        (digits < 1)
+        || (digits > MAX_DIGITS)
+    ) {
+        pr_err("unsupported number of simulated digits: %u\n", digits);
+        return ERR_PTR(-EINVAL);
+    }
+
+    bus = gpio_segled_new_bus(pdev, drv, ops, max_panels);
+    if (IS_ERR(bus)) {
+        return bus;
+    }
+    bus->records = devm_kcalloc(&pdev->dev, SIMULATED_RECORDS, sizeof(*bus->records), GFP_KERNEL);
+    if (!bus->records) {
+        return ERR_PTR(-ENOMEM);
+    }
+    bus->type = type;
+    bus->channels = 1;
+    bus->num_gpios = type->num_gpios;
+    bus->consumers = type->consumers;
+    bus->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+    return bus;
+}
+
+/**
+ * This reads the number of digits of a panel whose digits aren't driven
+ * by GPIOs of their own from the device tree ("digits").  The number was
+ * already checked when the bus of the panel was set up.
+ */
+static int gpio_segled_read_digits(struct platform_device* pdev, struct gpio_segled_device* dev_impl, struct fwnode_handle* child) {
+    u32 digits = 0;
+
+    (void)fwnode_property_read_u32(child, "digits", &digits);
+    dev_impl->num_digits = digits;
+    return 0;
+}
+
+/**
+ * This sets up the bus of a panel driven by a Holtek HT16K33 controller
+ * on the I2C bus given in the device tree ("i2c-bus", or "i2c-adapter" for
+ * the number of a bus with no device tree node of its own, such as one
+ * added by i2c-stub), at the address given there ("i2c-address", 0x70 if
+ * not given).  The segments are wired
+ * to the row outputs of the chip and the digit commons to its common
+ * outputs, and the number of digits is given in the device tree
+ * ("digits").  The panel has the bus to itself.
+ */
+static struct gpio_segled_bus* gpio_segled_get_controller_bus(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child, const struct segled_backend_ops* ops, int max_panels) {
+    const struct gpio_segled_segment_type* type;
+    struct gpio_segled_bus* bus;
+    struct device_node* adapter_np;
+    struct i2c_adapter* adapter;
+    struct i2c_client* client;
+    u32 address = HT16K33_DEFAULT_ADDRESS;
+    u32 adapter_nr;
+    u32 digits = 0;
+    int ret;
+
+    // Find out what kind of segmented device the panel is, and make sure
+    // the chip can drive it.
+    type = gpio_segled_get_segment_type(child);
+    if (IS_ERR(type)) {
+        return ERR_CAST(type);
+    }
+    if (type->num_gpios > HT16K33_MAX_SEGMENTS) {
+        pr_err("%d-segment devices are not supported by HT16K33 controllers\n", type->segments);
+        return ERR_PTR(-EINVAL);
+    }
+    (void)fwnode_property_read_u32(child, "digits", &digits);
+    if (
+        (digits < 1)
+        || (digits > HT16K33_MAX_DIGITS)
+    ) {
+        pr_err("unsupported number of HT16K33 digits: %u\n", digits);
+        return ERR_PTR(-EINVAL);
+    }
+    (void)fwnode_property_read_u32(child, "i2c-address", &address);
+
+    // Attempt to reach the chip, holding on to its I2C bus for as long
+    // as the driver is loaded.
+    if (!fwnode_property_read_u32(child, "i2c-adapter", &adapter_nr)) {
+        adapter = i2c_get_adapter(adapter_nr);
+    } else {
+        adapter_np = of_parse_phandle(to_of_node(child), "i2c-bus", 0);
+        if (!adapter_np) {
+            pr_err("unable to look up i2c-bus\n");
+            return ERR_PTR(-EINVAL);
+        }
+        adapter = of_get_i2c_adapter_by_node(adapter_np);
+        of_node_put(adapter_np);
+    }
+    if (!adapter) {
+        return ERR_PTR(-EPROBE_DEFER);
+    }
+    bus = gpio_segled_new_bus(pdev, drv, ops, max_panels);
+    if (IS_ERR(bus)) {
+        i2c_put_adapter(adapter);
+        return bus;
+    }
+    client = i2c_new_dummy_device(adapter, address);
+    if (IS_ERR(client)) {
+        ret = PTR_ERR(client);
+        pr_err("unable to add HT16K33 at address 0x%02x: error code %d\n", address, ret);
+        i2c_put_adapter(adapter);
+        return ERR_PTR(ret);
+    }
+    bus->controller = client;
+    bus->type = type;
+    bus->channels = 1;
+    bus->num_gpios = type->num_gpios;
+    bus->consumers = type->consumers;
+    bus->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+
+    // Start the chip's oscillator and have it drive its rows as outputs,
+    // leaving the display off until the first frame is written out.
+    bus->controller_frame_pending = 1;
+    bus->controller_brightness = 0;
+    bus->controller_blink_rate = 0;
+    ret = i2c_smbus_write_byte(client, HT16K33_CMD_OSCILLATOR | HT16K33_ON);
+    if (!ret) {
+        ret = i2c_smbus_write_byte(client, HT16K33_CMD_ROW_INT);
+    }
+    if (!ret) {
+        ret = i2c_smbus_write_byte(client, HT16K33_CMD_DISPLAY);
+    }
+    if (ret < 0) {
+        pr_err("unable to set up HT16K33: error code %d\n", ret);
+        return ERR_PTR(ret);
+    }
+    return bus;
+}
+
+/**
+ * This reads the map of which pins light which segments of which digits
+ * of a charlieplexed panel from the device tree ("charlieplex-leds"),
+ * giving the anode and cathode pins of each LED in turn, digit by digit
+ * and segment by segment, with the decimal point last.  The number of
+ * digits follows from the length of the map.
+ */
+static int gpio_segled_read_charlieplex_leds(struct platform_device* pdev, struct gpio_segled_device* dev_impl, struct fwnode_handle* child) {
+    int leds_per_digit = dev_impl->bus->type->num_gpios;
+    int count, index, ret;
+
+    count = fwnode_property_count_u32(child, "charlieplex-leds");
+    if (
+        (count <= 0)
+        || (count % (leds_per_digit * 2))
+        || (count / (leds_per_digit * 2) > MAX_DIGITS)
+    ) {
+        pr_err("charlieplex-leds must list an anode and cathode for each segment of each digit\n");
+        return -EINVAL;
+    }
+    dev_impl->charlieplex_leds = kcalloc(count, sizeof(*dev_impl->charlieplex_leds), GFP_KERNEL);
+    if (!dev_impl->charlieplex_leds) {
+        return -ENOMEM;
+    }
+    ret = fwnode_property_read_u32_array(child, "charlieplex-leds", dev_impl->charlieplex_leds, count);
+    if (ret) {
+        pr_err("unable to read charlieplex-leds: error code %d\n", ret);
+        return ret;
+    }
+    for (index = 0; index < count; index += 2) {
+        if (
+            (dev_impl->charlieplex_leds[index] > dev_impl->bus->num_gpios)
+            || (dev_impl->charlieplex_leds[index + 1] > dev_impl->bus->num_gpios)
+            || (
+                dev_impl->charlieplex_leds[index]
+                && (dev_impl->charlieplex_leds[index] == dev_impl->charlieplex_leds[index + 1])
+            )
+        ) {
+            pr_err("invalid pins for LED %d in charlieplex-leds\n", index / 2);
+            return -EINVAL;
+        }
+    }
+    dev_impl->num_digits = count / (leds_per_digit * 2);
+    return 0;
+}
+
+/**
+ * This sets up and registers a virtual display spanning the panels
+ * listed for it in the device tree ("panels").
+ */
+static int gpio_segled_add_virtual(struct platform_device* pdev, struct gpio_segled_driver* drv, struct fwnode_handle* child) {
+    struct gpio_segled_virtual* vdev;
+    struct gpio_segled_device* dev_impl;
+    struct fwnode_reference_args args;
+    struct device_node* np = to_of_node(child);
+    int count, panel, ret;
+
+    count = fwnode_property_count_u32(child, "panels");
+    if (count <= 0) {
+        pr_err("no panels given for %s\n", np->name);
+        return -EINVAL;
+    }
+    vdev = kzalloc(sizeof(*vdev) + sizeof(*vdev->panels) * count, GFP_KERNEL);
+    if (!vdev) {
+        return -ENOMEM;
+    }
+    device_initialize(&vdev->dev);
+    vdev->dev.parent = &pdev->dev;
+    vdev->dev.release = gpio_segled_virtual_release;
+    vdev->dev.groups = gpio_segled_virtual_attr_groups;
+
+    // Look up each panel among those already registered.
+    for (vdev->num_panels = 0; vdev->num_panels < count; ++vdev->num_panels) {
+        ret = fwnode_property_get_reference_args(child, "panels", NULL, 0, vdev->num_panels, &args);
+        if (ret) {
+            pr_err("unable to get panel %d of %s: error code %d\n", vdev->num_panels, np->name, ret);
+            goto unwind;
+        }
+        dev_impl = NULL;
+        for (panel = 0; panel < drv->num_panels; ++panel) {
+            if (container_of(drv->devices[panel], struct gpio_segled_device, dev)->fwnode == args.fwnode) {
+                dev_impl = container_of(drv->devices[panel], struct gpio_segled_device, dev);
+                break;
+            }
+        }
+        fwnode_handle_put(args.fwnode);
+        if (!dev_impl) {
+            ret = -EINVAL;
+            pr_err("panel %d of %s is not a gpio-segled panel\n", vdev->num_panels, np->name);
+            goto unwind;
+        }
+        vdev->panels[vdev->num_panels] = dev_impl;
+        vdev->num_chars += dev_impl->num_chars;
+        get_device(&dev_impl->dev);
+    }
+
+    // Register the display with the kernel.
+    ret = dev_set_name(&vdev->dev, np->name);
+    if (ret) {
+        pr_err("unable to set %s device name: error code %d\n", np->name, ret);
+        goto unwind;
+    }
+    ret = device_add(&vdev->dev);
+    if (ret) {
+        pr_err("unable to register %s device: error code %d\n", np->name, ret);
+        goto unwind;
+    }
+    drv->devices[drv->num_devices++] = &vdev->dev;
+    pr_info("device added: %s\n", np->name);
+
+    // Bring the scanning cycles of all the panels into step.
+    gpio_segled_virtual_align(vdev);
+    return 0;
+unwind:
+    put_device(&vdev->dev);
+    return ret;
+}
+
+/**
+ * These are the backends which can drive the LEDs of a bus:
+ * - "gpio" switches segment and digit GPIOs one at a time.
+ * - "gpio-array" switches them all in one go, which is best for GPIOs on
+ *   I2C or SPI expander chips, and is used for them by default.
+ * - "charlieplex" drives the pins of a charlieplexed panel.
+ * - "shift-register" shifts segments and digits out to 74HC595 (or
+ *   similar) shift registers.
+ * - "ht16k33" hands frames over to an HT16K33 controller chip.
+ * - "simulated" just records each slot of the scanning cycle.
+ */
+static const struct segled_backend_ops gpio_segled_gpio_backend = {
+    .name = "gpio",
+    .acquire = gpio_segled_get_bus,
+    .acquire_panel = gpio_segled_get_digit_gpios,
+    .apply = gpio_segled_gpio_apply,
+    .cansleep = gpio_segled_gpio_cansleep,
+    .release = gpio_segled_darken,
+};
+
+static const struct segled_backend_ops gpio_segled_gpio_array_backend = {
+    .name = "gpio-array",
+    .acquire = gpio_segled_get_bus,
+    .acquire_panel = gpio_segled_get_digit_gpios,
+    .apply = gpio_segled_gpio_array_apply,
+    .cansleep = gpio_segled_gpio_cansleep,
+    .release = gpio_segled_darken,
+};
+
+static const struct segled_backend_ops gpio_segled_charlieplex_backend = {
+    .name = "charlieplex",
+    .acquire = gpio_segled_get_charlieplex_bus,
+    .acquire_panel = gpio_segled_read_charlieplex_leds,
+    .apply = gpio_segled_charlieplex_apply,
+    .cansleep = gpio_segled_charlieplex_cansleep,
+    .release = gpio_segled_darken,
+};
+
+static const struct segled_backend_ops gpio_segled_shift_register_backend = {
+    .name = "shift-register",
+    .acquire = gpio_segled_get_shift_register_bus,
+    .acquire_panel = gpio_segled_read_digits,
+    .apply = gpio_segled_shift_register_apply,
+    .cansleep = gpio_segled_shift_register_cansleep,
+    .release = gpio_segled_darken,
+};
+
+static const struct segled_backend_ops gpio_segled_controller_backend = {
+    .name = "ht16k33",
+    .acquire = gpio_segled_get_controller_bus,
+    .acquire_panel = gpio_segled_read_digits,
+    .update = gpio_segled_controller_update,
+    .cansleep = gpio_segled_controller_cansleep,
+    .release = gpio_segled_controller_release,
+};
+
+static const struct segled_backend_ops gpio_segled_simulated_backend = {
+    .name = "simulated",
+    .acquire = gpio_segled_get_simulated_bus,
+    .acquire_panel = gpio_segled_read_digits,
+    .apply = gpio_segled_simulated_apply,
+    .cansleep = gpio_segled_simulated_cansleep,
+};
+
+static const struct segled_backend_ops* gpio_segled_backends[] = {
+    &gpio_segled_gpio_backend,
+    &gpio_segled_gpio_array_backend,
+    &gpio_segled_charlieplex_backend,
+    &gpio_segled_shift_register_backend,
+    &gpio_segled_controller_backend,
+    &gpio_segled_simulated_backend,
 };
 
+/**
+ * This finds the backend to drive a panel, as given in the device tree
+ * ("backend"), or else as suggested by its other properties.
+ */
+static const struct segled_backend_ops* gpio_segled_get_backend(struct fwnode_handle* child) {
+    const char* name;
+    int index;
+
+    if (!fwnode_property_read_string(child, "backend", &name)) {
+        for (index = 0; index < ARRAY_SIZE(gpio_segled_backends); ++index) {
+            if (!strcmp(gpio_segled_backends[index]->name, name)) {
+                return gpio_segled_backends[index];
+            }
+        }
+        pr_err("unknown backend: %s\n", name);
+        return ERR_PTR(-EINVAL);
+    }
+    if (fwnode_property_present(child, "charlieplex-leds")) {
+        return &gpio_segled_charlieplex_backend;
+    }
+    if (
+        fwnode_property_present(child, "i2c-bus")
+        || fwnode_property_present(child, "i2c-adapter")
+    ) {
+        return &gpio_segled_controller_backend;
+    }
+    if (fwnode_property_present(child, "simulated")) {
+        return &gpio_segled_simulated_backend;
+    }
+    if (
+        fwnode_property_present(child, "data-gpios")
+        || fwnode_property_present(child, "data-gpio")
+    ) {
+        return &gpio_segled_shift_register_backend;
+    }
+    return &gpio_segled_gpio_backend;
+}
+
 /**
  * This is called by the kernel whenever the driver is loaded, to set
  * up any configured devices.
  */
 static int gpio_segled_probe(struct platform_device* pdev) {
     struct gpio_segled_driver* drv;
+    struct gpio_segled_bus* bus;
+    struct gpio_desc* sync_gpio;
     struct fwnode_handle* child;
     struct device_node* np;
-    int count, digit, ret;
-    enum gpio_segled_gpios gpio;
+    const struct segled_backend_ops* ops;
+    const char* sync_mode;
+    char name[64];
+    int count, index, panel, digit, frame, irq, ret;
+    ktime_t start;
     struct gpio_segled_device* cdev;
 
     // Get the number of devices listed in the device tree.  Return early
@@ -503,11 +5223,19 @@ static int gpio_segled_probe(struct platform_device* pdev) {
     if (!drv) {
         return -ENOMEM;
     }
+    drv->buses = devm_kcalloc(&pdev->dev, count, sizeof(*drv->buses), GFP_KERNEL);
+    if (!drv->buses) {
+        return -ENOMEM;
+    }
     platform_set_drvdata(pdev, drv);
 
-    // Configure and register each device.
+    // Configure and register each panel.  Virtual displays spanning
+    // panels are set up afterwards, once all the panels exist.
     device_for_each_child_node(&pdev->dev, child) {
         np = to_of_node(child);
+        if (fwnode_property_present(child, "panels")) {
+            continue;
+        }
 
         // Allocate and initialize the state for the new device.
         cdev = kzalloc(sizeof(*cdev), GFP_KERNEL);
@@ -516,36 +5244,153 @@ static int gpio_segled_probe(struct platform_device* pdev) {
             goto unwind;
         }
         device_initialize(&cdev->dev);
-        for (digit = 0; digit < NUM_DIGITS; ++digit) {
-            cdev->digits[digit] = ' ';
-        }
-        cdev->refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ;
+        cdev->fwnode = child;
         cdev->brightness_percent = DEFAULT_BRIGHTNESS_PERCENT;
+        cdev->scroll_step_ms = DEFAULT_SCROLL_STEP_MS;
+        cdev->level_percent = DEFAULT_BRIGHTNESS_PERCENT;
+        cdev->fade_to_percent = DEFAULT_BRIGHTNESS_PERCENT;
         cdev->dev.parent = &pdev->dev;
         cdev->dev.release = gpio_segled_device_release;
         cdev->dev.groups = gpio_segled_attr_groups;
+        cdev->misc_id = -1;
+        mutex_init(&cdev->misc_lock);
+        spin_lock_init(&cdev->shown_lock);
+        init_waitqueue_head(&cdev->shown_wait);
+        if (fwnode_property_present(child, "seg-adjust")) {
+            cdev->seg_adjust = 1;
+        }
+
+        // Find the segment bus of the panel, and have its backend set it
+        // up, unless another panel already shares it, and then find out
+        // how many digits the panel has.
+        ops = gpio_segled_get_backend(child);
+        if (IS_ERR(ops)) {
+            ret = PTR_ERR(ops);
+            goto unwind_dev_partial;
+        }
+        cdev->bus = ops->acquire(pdev, drv, child, ops, count);
+        if (IS_ERR(cdev->bus)) {
+            ret = PTR_ERR(cdev->bus);
+            goto unwind_dev_partial;
+        }
+        bus = cdev->bus;
+        if (fwnode_property_present(child, "backend")) {
+            bus->ops_given = 1;
+        }
+        cdev->digit_base = bus->num_digits;
+        ret = ops->acquire_panel(pdev, cdev, child);
+        if (ret) {
+            goto unwind_dev_partial;
+        }
+        if (bus->type) {
+            memcpy(&cdev->map, bus->type->default_map, bus->type->map_size);
+        }
+
+        // Dot-matrix panels show as many characters of text as fit
+        // across them.
+        cdev->num_chars = cdev->num_digits;
+        if (!bus->type) {
+            cdev->num_chars = max(1, (bus->num_gpios + 1) / (FONT_5X7_WIDTH + 1));
+        }
+        cdev->num_slots = bus->charlieplex ? bus->num_gpios : (cdev->num_digits * bus->channels);
+        for (frame = 0; frame < ARRAY_SIZE(cdev->frames); ++frame) {
+            cdev->frames[frame].digits = kcalloc(cdev->num_chars, sizeof(*cdev->frames[frame].digits), GFP_KERNEL);
+            cdev->frames[frame].decimal_points = kcalloc(cdev->num_chars, sizeof(*cdev->frames[frame].decimal_points), GFP_KERNEL);
+            cdev->frames[frame].segments = kcalloc(cdev->num_digits, sizeof(*cdev->frames[frame].segments), GFP_KERNEL);
+            cdev->frames[frame].digit_brightness = kcalloc(cdev->num_digits, sizeof(*cdev->frames[frame].digit_brightness), GFP_KERNEL);
+            cdev->frames[frame].digit_blink = kcalloc(cdev->num_digits, sizeof(*cdev->frames[frame].digit_blink), GFP_KERNEL);
+            if (
+                !cdev->frames[frame].digits
+                || !cdev->frames[frame].decimal_points
+                || !cdev->frames[frame].segments
+                || !cdev->frames[frame].digit_brightness
+                || !cdev->frames[frame].digit_blink
+            ) {
+                ret = -ENOMEM;
+                goto unwind_dev_partial;
+            }
+            for (digit = 0; digit < cdev->num_chars; ++digit) {
+                cdev->frames[frame].digits[digit] = ' ';
+            }
+            memset(cdev->frames[frame].digit_brightness, 100, cdev->num_digits * sizeof(*cdev->frames[frame].digit_brightness));
+            cdev->frames[frame].brightness_percent = -1;
+            if (bus->channels > 1) {
+                cdev->frames[frame].colors = kcalloc(cdev->num_digits, sizeof(*cdev->frames[frame].colors), GFP_KERNEL);
+                if (!cdev->frames[frame].colors) {
+                    ret = -ENOMEM;
+                    goto unwind_dev_partial;
+                }
+                for (digit = 0; digit < cdev->num_digits; ++digit) {
+                    cdev->frames[frame].colors[digit] = DEFAULT_COLOR;
+                }
+            }
+            if (bus->charlieplex) {
+                cdev->frames[frame].plan_high = kcalloc(cdev->num_slots, sizeof(*cdev->frames[frame].plan_high), GFP_KERNEL);
+                cdev->frames[frame].plan_low = kcalloc(cdev->num_slots, sizeof(*cdev->frames[frame].plan_low), GFP_KERNEL);
+                if (
+                    !cdev->frames[frame].plan_high
+                    || !cdev->frames[frame].plan_low
+                ) {
+                    ret = -ENOMEM;
+                    goto unwind_dev_partial;
+                }
+            }
+        }
+        cdev->shown = &cdev->frames[0];
+        cdev->staged = &cdev->frames[1];
+        cdev->queue_segments = kcalloc(QUEUE_FRAMES * cdev->num_digits, sizeof(*cdev->queue_segments), GFP_KERNEL);
+        if (!cdev->queue_segments) {
+            ret = -ENOMEM;
+            goto unwind_dev_partial;
+        }
 
-        // Attempt to reserve and configure the GPIOs listed for
-        // the device in the device tree.
-        for (gpio = 0; gpio < SEGLED_GPIO_MAX; ++gpio) {
-            if (fwnode_property_present(child, "seg-adjust")) {
-                cdev->seg_adjust = 1;
+        // The frame sync GPIO is optional, and if present selects
+        // phase-locking to it unless the device tree says otherwise.
+        // It applies to the whole segment bus, so only one panel on
+        // a bus may have one.
+        sync_gpio = devm_fwnode_gpiod_get(&pdev->dev, child, "sync", GPIOD_IN, "sync");
+        if (IS_ERR(sync_gpio)) {
+            ret = PTR_ERR(sync_gpio);
+            if (ret != -ENOENT) {
+                pr_err("unable to get sync GPIO: error code %d\n", ret);
+                goto unwind_dev_partial;
             }
-            cdev->gpios[gpio] = devm_get_gpiod_from_child(&pdev->dev, gpio_segled_gpio_consumers[gpio], child);
-            if (IS_ERR(cdev->gpios[gpio])) {
-                ret = PTR_ERR(cdev->gpios[gpio]);
-                pr_err("unable to get %s GPIO: error code %d\n", gpio_segled_gpio_consumers[gpio], ret);
+        } else {
+            if (bus->sync_gpio) {
+                ret = -EBUSY;
+                pr_err("more than one sync GPIO given for the same segment GPIOs\n");
                 goto unwind_dev_partial;
             }
-            ret = gpiod_direction_output(cdev->gpios[gpio], 0);
-            if (ret) {
-                pr_err("unable to set %s GPIO direction: error code %d\n", gpio_segled_gpio_consumers[gpio], ret);
+            bus->sync_gpio = sync_gpio;
+            bus->sync_mode = SEGLED_SYNC_PLL;
+            if (!fwnode_property_read_string(child, "sync-mode", &sync_mode)) {
+                ret = match_string(gpio_segled_sync_modes, SEGLED_SYNC_MAX, sync_mode);
+                if (ret < 0) {
+                    pr_err("unknown sync mode: %s\n", sync_mode);
+                    goto unwind_dev_partial;
+                }
+                bus->sync_mode = ret;
+            }
+        }
+
+        // The PWM gating the digit commons is optional, and if present
+        // takes over applying the brightness of the panel.  Backends
+        // which do their own scanning apply brightness themselves.
+        if (fwnode_property_present(child, "pwms")) {
+            if (bus->ops->update) {
+                ret = -EINVAL;
+                pr_err("PWM given for %s panel\n", bus->ops->name);
+                goto unwind_dev_partial;
+            }
+            cdev->pwm = devm_fwnode_pwm_get(&pdev->dev, child, NULL);
+            if (IS_ERR(cdev->pwm)) {
+                ret = PTR_ERR(cdev->pwm);
+                pr_err("unable to get PWM: error code %d\n", ret);
                 goto unwind_dev_partial;
             }
         }
 
-        // Finish configuring the device and register it with the kernel.
-        INIT_WORK(&cdev->update_digits_work, execute_update_digits);
+        // Register the device with the kernel.
         ret = dev_set_name(&cdev->dev, np->name);
         if (ret) {
             pr_err("unable to set %s device name: error code %d\n", np->name, ret);
@@ -556,21 +5401,102 @@ static int gpio_segled_probe(struct platform_device* pdev) {
             pr_err("unable to register %s device: error code %d\n", np->name, ret);
             goto unwind;
         }
-        drv->devices[drv->num_devices++] = cdev;
+        drv->devices[drv->num_devices++] = &cdev->dev;
+        drv->num_panels = drv->num_devices;
         pr_info("device added: %s\n", np->name);
+        ret = gpio_segled_misc_add(cdev);
+        if (ret) {
+            goto unwind;
+        }
+
+        // Add the panel to the scanning order of its bus.
+        bus->panels[bus->num_panels++] = cdev;
+        bus->num_slots += cdev->num_slots;
+        bus->num_digits += cdev->num_digits;
+
+        // Let the slots of simulated panels be read through debugfs.
+        if (bus->records) {
+            if (!drv->debugfs) {
+                drv->debugfs = debugfs_create_dir(dev_name(&pdev->dev), NULL);
+            }
+            (void)debugfs_create_file(dev_name(&cdev->dev), 0444, drv->debugfs, bus, &gpio_segled_records_fops);
+        }
+    }
+
+    // Start scanning each bus, listening for frame sync edges on those
+    // with a sync signal.  Buses whose backend does its own scanning only
+    // have their first frame written out.  Buses of GPIOs which sleep
+    // switch them all in one go, unless the device tree says otherwise.
+    start = ktime_get();
+    for (index = 0; index < drv->num_buses; ++index) {
+        bus = drv->buses[index];
+        if (bus->sync_gpio) {
+            irq = gpiod_to_irq(bus->sync_gpio);
+            if (irq < 0) {
+                ret = irq;
+                pr_err("unable to get sync GPIO interrupt: error code %d\n", ret);
+                goto unwind;
+            }
+            ret = devm_request_irq(&pdev->dev, irq, gpio_segled_sync_irq, IRQF_TRIGGER_RISING, dev_name(&bus->panels[0]->dev), bus);
+            if (ret) {
+                pr_err("unable to request sync GPIO interrupt: error code %d\n", ret);
+                goto unwind;
+            }
+        }
+        if (
+            (bus->ops == &gpio_segled_gpio_backend)
+            && !bus->ops_given
+            && bus->ops->cansleep(bus)
+        ) {
+            bus->ops = &gpio_segled_gpio_array_backend;
+        }
+        bus->cansleep = bus->ops->cansleep(bus);
+
+        // Let the transfer errors of buses switched in one go be read
+        // through debugfs, named after the first panel on the bus.
+        if (bus->ops == &gpio_segled_gpio_array_backend) {
+            if (!drv->debugfs) {
+                drv->debugfs = debugfs_create_dir(dev_name(&pdev->dev), NULL);
+            }
+            (void)snprintf(name, sizeof(name), "%s-bus_errors", dev_name(&bus->panels[0]->dev));
+            debugfs_create_u32(name, 0444, drv->debugfs, &bus->bus_errors);
+        }
+        for (panel = 0; panel < bus->num_panels; ++panel) {
+            if (bus->panels[panel]->pwm) {
+                gpio_segled_apply_pwm(bus->panels[panel], 1);
+            }
+        }
+        gpio_segled_bus_rewind(bus);
+        hrtimer_start(&bus->digit_timer, start, HRTIMER_MODE_ABS);
+    }
 
-        // Configure and start the digit scanning timer.
-        hrtimer_init(&cdev->digit_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
-        cdev->digit_timer.function = gpio_segled_digit_timer_tick;
-        hrtimer_start(&cdev->digit_timer, ktime_get(), HRTIMER_MODE_ABS);
+    // Configure and register each virtual display.
+    device_for_each_child_node(&pdev->dev, child) {
+        if (!fwnode_property_present(child, "panels")) {
+            continue;
+        }
+        ret = gpio_segled_add_virtual(pdev, drv, child);
+        if (ret) {
+            goto unwind;
+        }
     }
 
     return 0;
 unwind_dev_partial:
-    kfree(cdev);
+    gpio_segled_device_free(cdev);
 unwind:
+    debugfs_remove_recursive(drv->debugfs);
+    for (count = 0; count < drv->num_panels; ++count) {
+        gpio_segled_misc_remove(container_of(drv->devices[count], struct gpio_segled_device, dev));
+    }
+    for (count = drv->num_devices - 1; count >= 0; --count) {
+        device_del(drv->devices[count]);
+    }
+    for (index = 0; index < drv->num_buses; ++index) {
+        gpio_segled_bus_stop(drv->buses[index]);
+    }
     for (count = drv->num_devices - 1; count >= 0; --count) {
-        device_unregister(&drv->devices[count]->dev);
+        put_device(drv->devices[count]);
     }
     return ret;
 }
@@ -580,14 +5506,28 @@ unwind:
  * in order to clean up any state and release any resources held
  * directly by the driver.
  */
-static int gpio_segled_remove(struct platform_device* pdev) {
+static void gpio_segled_remove(struct platform_device* pdev) {
     struct gpio_segled_driver* drv = platform_get_drvdata(pdev);
     int count;
 
+    debugfs_remove_recursive(drv->debugfs);
+    for (count = 0; count < drv->num_panels; ++count) {
+        gpio_segled_misc_remove(container_of(drv->devices[count], struct gpio_segled_device, dev));
+    }
+
+    // Take the devices out of sysfs before stopping the buses, so that
+    // nothing written to their attributes can restart the scanning timer
+    // or queue work on a bus once it has stopped.  Their memory is only
+    // let go of once the buses have stopped, since scanning reads it.
     for (count = drv->num_devices - 1; count >= 0; --count) {
-        device_unregister(&drv->devices[count]->dev);
+        device_del(drv->devices[count]);
+    }
+    for (count = 0; count < drv->num_buses; ++count) {
+        gpio_segled_bus_stop(drv->buses[count]);
+    }
+    for (count = drv->num_devices - 1; count >= 0; --count) {
+        put_device(drv->devices[count]);
     }
-    return 0;
 }
 
 // Open Firmware (OF) information for this driver
@@ -0,0 +1,184 @@
+/**
+ * segled-core.h - scanning core shared by gpio-segled and segledd
+ *
+ * This is the core of the scanning and committing logic for multiplexed
+ * LED panels, shared by the gpio-segled kernel module and the segledd
+ * userspace daemon, so that both divide the scanning cycle, work out duty
+ * cycles, latch new frames and parse the digits to show in the same way.
+ *
+ * Everything here is plain C, with no dependencies on either the kernel
+ * or the C library beyond the integer types.
+ */
+#ifndef SEGLED_CORE_H
+#define SEGLED_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+#endif
+
+/**
+ * This divides a 64-bit number by a 32-bit number, which some of the
+ * 32-bit processors the kernel runs on can't do without help.
+ */
+static inline u64 segled_div_u64(u64 dividend, u32 divisor) {
+#ifdef __KERNEL__
+    return div_u64(dividend, divisor);
+#else
+    return dividend / divisor;
+#endif
+}
+
+/**
+ * This counts the segments lit in a segment bitmap.
+ */
+static inline int segled_weight32(u32 segments) {
+#ifdef __KERNEL__
+    return hweight32(segments);
+#else
+    return __builtin_popcount(segments);
+#endif
+}
+
+/**
+ * This works out how far into the scanning cycle the given slot starts.
+ * Each slot is given an equal share of the cycle, measured from the start
+ * of the cycle so that rounding never accumulates from one slot (or cycle)
+ * to the next.
+ */
+static inline u64 segled_slot_offset_ns(u64 cycle_ns, int slot, int num_slots) {
+    return segled_div_u64(cycle_ns * slot, num_slots);
+}
+
+/**
+ * This works out how long a digit is lit within its slot, for the given
+ * duty cycle.
+ */
+static inline u64 segled_slot_on_ns(u64 slot_ns, int duty_cycle_percent) {
+    return segled_div_u64(slot_ns * duty_cycle_percent, 100);
+}
+
+/**
+ * This adjusts the duty cycle of a digit for the number of segments lit,
+ * for designs which limit the current on the common pins rather than on
+ * the segment pins ("seg-adjust"), so that digits with few segments lit
+ * don't look brighter than digits with many.
+ */
+static inline int segled_adjust_duty(int duty_cycle_percent, u32 segments, int channels, int num_gpios) {
+    return duty_cycle_percent * segled_weight32(segments) * channels / num_gpios;
+}
+
+/**
+ * This tells whether a frame staged to be latched at the given time is due
+ * at a scanning cycle starting at the given time.  Cycles starting a little
+ * early (up to half a cycle) still count, to allow for panels on slightly
+ * different clocks reaching the same cycle boundary at slightly different
+ * times.
+ */
+static inline int segled_commit_due(s64 now_ns, s64 commit_at_ns, u64 cycle_ns) {
+    return now_ns >= commit_at_ns - (s64)(cycle_ns / 2);
+}
+
+/**
+ * This parses the characters to show on a display, in the format accepted
+ * by the "digits" attribute, into a digit buffer and decimal point flags.
+ * The characters are right-justified, padding the left with blanks.
+ */
+static inline void segled_parse_digits(const char* buf, size_t len, int num_digits, char* digits, int* decimal_points) {
+    int digit_in = 0;
+    int digit_out;
+
+    // Initialize digits with all blanks.
+    for (digit_out = 0; digit_out < num_digits; ++digit_out) {
+        digits[digit_out] = ' ';
+        decimal_points[digit_out] = 0;
+    }
+
+    // Read in characters one at at time, copying them to the digit
+    // buffer or setting decimal point flags as appropriate.
+    digit_out = 0;
+    for (digit_in = 0; digit_in < (int)len; ++digit_in) {
+        // Stop early if a non-printable character is encountered
+        // or we run out of output digits.
+        if (
+            (buf[digit_in] < 32)
+            || (digit_out >= num_digits)
+        ) {
+            break;
+        }
+
+        // If the character is a decimal point, activate decimal point
+        // for the previous digit (if any).  Otherwise copy the character
+        // into the digit buffer.
+        if (
+            (buf[digit_in] == '.')
+            && (digit_out > 0)
+        ) {
+            decimal_points[digit_out - 1] = 1;
+        } else {
+            digits[digit_out++] = buf[digit_in];
+        }
+    }
+
+    // If not all digits were populated, shift them to the right, padding
+    // the left with blanks.
+    if (digit_out < num_digits) {
+        digit_in = digit_out - 1;
+        for (digit_out = num_digits - 1; digit_out >= 0; --digit_out, --digit_in) {
+            if (digit_in >= 0) {
+                digits[digit_out] = digits[digit_in];
+                decimal_points[digit_out] = decimal_points[digit_in];
+            } else {
+                digits[digit_out] = ' ';
+                decimal_points[digit_out] = 0;
+            }
+        }
+    }
+}
+
+/**
+ * This is what reading the character device of a panel ("/dev/segledN")
+ * gives once a new frame has been fully scanned out: how many frames the
+ * panel has shown since it was added, and when the latest of them was
+ * first fully scanned out, in nanoseconds of the monotonic clock.
+ */
+struct segled_frame_event {
+    u64 sequence;
+    s64 time_ns;
+};
+
+/**
+ * This is the most digits a panel's shared frame (see below) holds.
+ */
+#define SEGLED_SHARED_MAX_DIGITS 32
+
+/**
+ * This is the layout of the page shared by mapping the character device
+ * of a panel.  A single writer publishes a frame by making the sequence
+ * number odd, storing the segments and brightness, and then making the
+ * sequence number even again (one more than the odd number).  At the start
+ * of each scanning cycle, the driver takes the frame if the sequence
+ * number is even and has changed, and reads the same before and after the
+ * frame.  Otherwise it leaves the frame for the next cycle.
+ *
+ * The driver fills in the number of digits when the page is mapped.  The
+ * segments of each digit are as for the "segments" attribute, except that
+ * bits above the number of segments (or columns) of the panel are ignored
+ * rather than refused.
+ */
+struct segled_shared_frame {
+    u32 sequence;
+    u32 num_digits;
+    u32 brightness_percent;
+    u32 reserved;
+    u32 segments[SEGLED_SHARED_MAX_DIGITS];
+};
+
+#endif /* SEGLED_CORE_H */
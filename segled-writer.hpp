@@ -0,0 +1,127 @@
+/**
+ * segled-writer.hpp - writer side of the frame shared with gpio-segled
+ *
+ * This maps the page a panel shares with userspace through its character
+ * device ("/dev/segledN"), and publishes frames to it without any system
+ * calls, following the protocol described for struct segled_shared_frame
+ * in segled-core.h.  The driver takes the latest frame published at the
+ * start of each scanning cycle, so a producer may publish as often as it
+ * likes, and frames published within the same cycle simply replace each
+ * other.
+ *
+ * Publishing never blocks or fails, but there must be only one writer for
+ * each panel at a time.  Requires C++20 (for std::atomic_ref and
+ * std::span).
+ *
+ * Example:
+ *   segled::frame_writer writer("/dev/segled0");
+ *   std::uint32_t segments[4] = {0x06, 0x5b, 0x4f, 0x66};
+ *   writer.publish(segments);
+ */
+#ifndef SEGLED_WRITER_HPP
+#define SEGLED_WRITER_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "segled-core.h"
+
+namespace segled {
+
+class frame_writer {
+public:
+    /**
+     * This opens the character device of a panel and maps its shared
+     * frame, throwing std::system_error if either fails.
+     */
+    explicit frame_writer(const char* path) {
+        void* page;
+
+        fd_ = ::open(path, O_RDWR | O_CLOEXEC);
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        page = ::mmap(nullptr, sizeof(segled_shared_frame), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (page == MAP_FAILED) {
+            int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        frame_ = static_cast<segled_shared_frame*>(page);
+    }
+
+    ~frame_writer() {
+        ::munmap(frame_, sizeof(segled_shared_frame));
+        ::close(fd_);
+    }
+
+    frame_writer(const frame_writer&) = delete;
+    frame_writer& operator=(const frame_writer&) = delete;
+
+    /**
+     * This gives the number of digits of the panel, which is how many
+     * segment words a frame takes.
+     */
+    std::size_t num_digits() const {
+        return frame_->num_digits;
+    }
+
+    /**
+     * This gives the file descriptor of the character device, for example
+     * to poll it for frames being fully scanned out.
+     */
+    int fd() const {
+        return fd_;
+    }
+
+    /**
+     * This publishes the segments to light for each digit (as for the
+     * "segments" attribute), keeping the brightness last published.
+     * Digits not given are left dark.
+     */
+    void publish(std::span<const std::uint32_t> segments) {
+        publish(segments, std::atomic_ref<std::uint32_t>(frame_->brightness_percent).load(std::memory_order_relaxed));
+    }
+
+    /**
+     * This publishes the segments to light for each digit, along with
+     * the brightness in percent of maximum.
+     */
+    void publish(std::span<const std::uint32_t> segments, std::uint32_t brightness_percent) {
+        std::atomic_ref<std::uint32_t> sequence(frame_->sequence);
+        std::size_t digit;
+
+        // Make the sequence number odd while the frame is being written.
+        // It may already be odd if an earlier writer was interrupted.
+        std::uint32_t writing = sequence.load(std::memory_order_relaxed) | 1u;
+        sequence.store(writing, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (digit = 0; digit < num_digits(); ++digit) {
+            std::atomic_ref<std::uint32_t>(frame_->segments[digit]).store(
+                digit < segments.size() ? segments[digit] : 0,
+                std::memory_order_relaxed
+            );
+        }
+        std::atomic_ref<std::uint32_t>(frame_->brightness_percent).store(brightness_percent, std::memory_order_relaxed);
+
+        // Making the sequence number even again publishes the frame.
+        sequence.store(writing + 1, std::memory_order_release);
+    }
+
+private:
+    int fd_;
+    segled_shared_frame* frame_;
+};
+
+} // namespace segled
+
+#endif /* SEGLED_WRITER_HPP */
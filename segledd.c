@@ -0,0 +1,464 @@
+/**
+ * segledd - userspace daemon for GPIO-based segmented LEDs
+ *
+ * This is a userspace counterpart of the gpio-segled kernel module, for
+ * systems on which loading an out-of-tree module isn't an option.  It
+ * multiplexes a single seven-segment LED panel through the GPIO character
+ * device, sharing the scanning and committing logic of the kernel module
+ * (see segled-core.h), and shows each line of text read from its standard
+ * input, in the format accepted by the "digits" attribute of the module,
+ * from the start of the next scanning cycle.
+ *
+ * All the lines of the panel are requested from the kernel at once, and
+ * each slot of the scanning cycle is driven with a single request setting
+ * all of them, so that on a single GPIO chip the digit and segments change
+ * together.  Scanning runs in a thread of its own, under the SCHED_FIFO
+ * real-time scheduling policy if permitted, sleeping until absolute times
+ * so that lateness never accumulates.
+ *
+ * Usage:
+ *   segledd [-c chip] -s sa,sb,sc,sd,se,sf,sg[,sp] -d d1,d2,...
+ *           [-r refresh] [-b brightness] [-a] [-S] [-D] [-p priority]
+ *
+ *   -c  GPIO character device of the chip (default /dev/gpiochip0)
+ *   -s  line offsets of the segments, decimal point last (optional)
+ *   -d  line offsets of the digit commons, from left to right
+ *   -r  refresh rate in Hertz (default 100)
+ *   -b  brightness in percent of maximum (default 100)
+ *   -a  adjust duty cycles for segments lit (as "seg-adjust")
+ *   -S  segment lines are active-low
+ *   -D  digit lines are active-low
+ *   -p  SCHED_FIFO priority of the scanning thread (default 50)
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <linux/map_to_7segment.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "segled-core.h"
+
+/**
+ * This is the largest number of digits the daemon supports.
+ */
+#define MAX_DIGITS 32
+
+/**
+ * These are the defaults for settings not given on the command line.
+ */
+#define DEFAULT_CHIP "/dev/gpiochip0"
+#define DEFAULT_REFRESH_RATE_HZ 100
+#define DEFAULT_BRIGHTNESS_PERCENT 100
+#define DEFAULT_PRIORITY 50
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/**
+ * This is the map from characters to segments, the same one the kernel
+ * module uses for seven-segment panels.
+ */
+static SEG7_CONVERSION_MAP(segledd_seg7map, MAP_ASCII7SEG_ALPHANUM_LC);
+
+/**
+ * This is the state of the daemon.
+ */
+struct segledd {
+    // Settings
+    int num_segments;
+    int num_digits;
+    unsigned int refresh_rate_hz;
+    int brightness_percent;
+    int seg_adjust;
+
+    // Lines requested from the kernel, and the values last set on them
+    // (if known).
+    int fd;
+    unsigned long long bits_set;
+    int bits_valid;
+    unsigned long errors;
+
+    // Frames to show, as segment bitmaps for each digit.  The shown frame
+    // is the one being scanned, and the other one, if commit_pending is
+    // set, replaces it at the start of the first scanning cycle at or
+    // after commit_at.
+    u32 frames[2][MAX_DIGITS];
+    int shown;
+    s64 commit_at;
+    atomic_int commit_pending;
+};
+
+/**
+ * This is set by the signal handler to stop scanning.
+ */
+static volatile sig_atomic_t segledd_stopping;
+
+static void segledd_stop(int signal) {
+    (void)signal;
+    segledd_stopping = 1;
+}
+
+/**
+ * This returns the current time on the clock used for scanning.
+ */
+static s64 segledd_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (s64)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+/**
+ * This sleeps until the given time on the clock used for scanning.
+ */
+static void segledd_sleep_until(s64 time_ns) {
+    struct timespec until = {
+        .tv_sec = time_ns / NSEC_PER_SEC,
+        .tv_nsec = time_ns % NSEC_PER_SEC,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+        if (segledd_stopping) {
+            break;
+        }
+    }
+}
+
+/**
+ * This sets all the lines of the panel in one go, lighting the given
+ * segments of the given digit, or no digit at all if the digit is -1.
+ * Nothing is sent if nothing is to change.  A failed request is not
+ * retried, which could hold up the scan, but leaves the state of the
+ * lines unknown, so they are all set again for the next slot.
+ */
+static void segledd_set(struct segledd* d, u32 segments, int digit) {
+    struct gpio_v2_line_values values = {0};
+
+    values.mask = (1ULL << (d->num_segments + d->num_digits)) - 1;
+    values.bits = segments;
+    if (digit >= 0) {
+        values.bits |= 1ULL << (d->num_segments + digit);
+    }
+    if (
+        d->bits_valid
+        && (values.bits == d->bits_set)
+    ) {
+        return;
+    }
+    if (ioctl(d->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+        ++d->errors;
+        d->bits_valid = 0;
+        return;
+    }
+    d->bits_set = values.bits;
+    d->bits_valid = 1;
+}
+
+/**
+ * This is the scanning thread, which steps through the digits of the panel
+ * once each scanning cycle, latching new frames at the start of the cycle.
+ */
+static void* segledd_scan(void* data) {
+    struct segledd* d = data;
+    s64 cycle_start = segledd_now();
+    s64 slot_start, slot_end;
+    u64 cycle_ns;
+    u32 segments;
+    int digit, duty_cycle_percent;
+
+    while (!segledd_stopping) {
+        cycle_ns = NSEC_PER_SEC / d->refresh_rate_hz;
+
+        // If we've fallen more than a whole cycle behind (for example,
+        // if the system was suspended), start afresh rather than rushing
+        // through the cycles missed.
+        if (segledd_now() > cycle_start + (s64)cycle_ns) {
+            cycle_start = segledd_now();
+        }
+
+        // Latch the staged frame if it is due.
+        if (
+            atomic_load_explicit(&d->commit_pending, memory_order_acquire)
+            && segled_commit_due(cycle_start, d->commit_at, cycle_ns)
+        ) {
+            d->shown = !d->shown;
+            atomic_store_explicit(&d->commit_pending, 0, memory_order_release);
+        }
+
+        // Light each digit in turn, for its share of the cycle.
+        for (digit = 0; digit < d->num_digits; ++digit) {
+            slot_start = cycle_start + segled_slot_offset_ns(cycle_ns, digit, d->num_digits);
+            slot_end = cycle_start + segled_slot_offset_ns(cycle_ns, digit + 1, d->num_digits);
+            segments = d->frames[d->shown][digit];
+            duty_cycle_percent = d->brightness_percent;
+            if (d->seg_adjust) {
+                duty_cycle_percent = segled_adjust_duty(duty_cycle_percent, segments, 1, d->num_segments);
+            }
+            segledd_sleep_until(slot_start);
+            if (duty_cycle_percent <= 0) {
+                segledd_set(d, d->bits_set & ((1ULL << d->num_segments) - 1), -1);
+                continue;
+            }
+            segledd_set(d, segments, digit);
+            if (duty_cycle_percent < 100) {
+                segledd_sleep_until(slot_start + segled_slot_on_ns(slot_end - slot_start, duty_cycle_percent));
+                segledd_set(d, segments, -1);
+            }
+        }
+        cycle_start += cycle_ns;
+    }
+
+    // Leave the panel dark.
+    segledd_set(d, 0, -1);
+    return NULL;
+}
+
+/**
+ * This stages a line of text to be shown from the start of the next
+ * scanning cycle, waiting first for any frame already staged to be
+ * latched.
+ */
+static void segledd_stage(struct segledd* d, const char* text) {
+    char digits[MAX_DIGITS];
+    int decimal_points[MAX_DIGITS];
+    struct timespec wait = {
+        .tv_nsec = 1000000,
+    };
+    u32* frame;
+    int segments, digit;
+
+    while (
+        atomic_load_explicit(&d->commit_pending, memory_order_acquire)
+        && !segledd_stopping
+    ) {
+        nanosleep(&wait, NULL);
+    }
+    segled_parse_digits(text, strlen(text), d->num_digits, digits, decimal_points);
+    frame = d->frames[!d->shown];
+    for (digit = 0; digit < d->num_digits; ++digit) {
+        segments = map_to_seg7(&segledd_seg7map, (unsigned char)digits[digit]);
+        frame[digit] = (segments < 0) ? 0 : segments;
+        if (
+            decimal_points[digit]
+            && (d->num_segments > 7)
+        ) {
+            frame[digit] |= 1 << 7;
+        }
+    }
+    d->commit_at = segledd_now();
+    atomic_store_explicit(&d->commit_pending, 1, memory_order_release);
+}
+
+/**
+ * This parses a comma-separated list of line offsets, returning how many
+ * there are, or -1 if the list is malformed or too long.
+ */
+static int segledd_parse_offsets(const char* list, __u32* offsets, int max_offsets) {
+    char* end;
+    int count = 0;
+
+    while (*list) {
+        if (count >= max_offsets) {
+            return -1;
+        }
+        offsets[count++] = strtoul(list, &end, 0);
+        if (
+            (end == list)
+            || (
+                (*end != ',')
+                && (*end != '\0')
+            )
+        ) {
+            return -1;
+        }
+        list = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+/**
+ * This requests all the lines of the panel from the kernel as outputs,
+ * all off, in a single request.
+ */
+static int segledd_request_lines(struct segledd* d, const char* chip, const __u32* segment_offsets, const __u32* digit_offsets, int segments_active_low, int digits_active_low) {
+    struct gpio_v2_line_request request;
+    struct gpio_v2_line_attribute* attr;
+    int fd, line, ret;
+
+    memset(&request, 0, sizeof(request));
+    strncpy(request.consumer, "segledd", sizeof(request.consumer) - 1);
+    request.num_lines = d->num_segments + d->num_digits;
+    for (line = 0; line < d->num_segments; ++line) {
+        request.offsets[line] = segment_offsets[line];
+    }
+    for (line = 0; line < d->num_digits; ++line) {
+        request.offsets[d->num_segments + line] = digit_offsets[line];
+    }
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    if (segments_active_low) {
+        attr = &request.config.attrs[request.config.num_attrs++].attr;
+        attr->id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->flags = GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+        request.config.attrs[request.config.num_attrs - 1].mask = (1ULL << d->num_segments) - 1;
+    }
+    if (digits_active_low) {
+        attr = &request.config.attrs[request.config.num_attrs++].attr;
+        attr->id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->flags = GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+        request.config.attrs[request.config.num_attrs - 1].mask = ((1ULL << d->num_digits) - 1) << d->num_segments;
+    }
+
+    fd = open(chip, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "segledd: unable to open %s: %s\n", chip, strerror(errno));
+        return -1;
+    }
+    ret = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &request);
+    if (ret < 0) {
+        fprintf(stderr, "segledd: unable to request lines: %s\n", strerror(errno));
+    }
+    close(fd);
+    if (ret < 0) {
+        return -1;
+    }
+    d->fd = request.fd;
+    return 0;
+}
+
+static void segledd_usage(void) {
+    fprintf(
+        stderr,
+        "usage: segledd [-c chip] -s sa,sb,sc,sd,se,sf,sg[,sp] -d d1,d2,...\n"
+        "               [-r refresh] [-b brightness] [-a] [-S] [-D] [-p priority]\n"
+    );
+}
+
+int main(int argc, char* argv[]) {
+    static struct segledd d = {
+        .refresh_rate_hz = DEFAULT_REFRESH_RATE_HZ,
+        .brightness_percent = DEFAULT_BRIGHTNESS_PERCENT,
+        .fd = -1,
+    };
+    const char* chip = DEFAULT_CHIP;
+    __u32 segment_offsets[8];
+    __u32 digit_offsets[MAX_DIGITS];
+    int segments_active_low = 0;
+    int digits_active_low = 0;
+    int priority = DEFAULT_PRIORITY;
+    struct sched_param param;
+    struct sigaction action;
+    sigset_t stop_signals;
+    sigset_t old_signals;
+    pthread_attr_t attr;
+    pthread_t scanner;
+    char line[256];
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "c:s:d:r:b:aSDp:")) != -1) {
+        switch (opt) {
+        case 'c':
+            chip = optarg;
+            break;
+        case 's':
+            d.num_segments = segledd_parse_offsets(optarg, segment_offsets, 8);
+            break;
+        case 'd':
+            d.num_digits = segledd_parse_offsets(optarg, digit_offsets, MAX_DIGITS);
+            break;
+        case 'r':
+            d.refresh_rate_hz = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            d.brightness_percent = atoi(optarg);
+            break;
+        case 'a':
+            d.seg_adjust = 1;
+            break;
+        case 'S':
+            segments_active_low = 1;
+            break;
+        case 'D':
+            digits_active_low = 1;
+            break;
+        case 'p':
+            priority = atoi(optarg);
+            break;
+        default:
+            segledd_usage();
+            return 1;
+        }
+    }
+    if (
+        (d.num_segments < 7)
+        || (d.num_digits < 1)
+        || (d.refresh_rate_hz < 1)
+    ) {
+        segledd_usage();
+        return 1;
+    }
+    if (segledd_request_lines(&d, chip, segment_offsets, digit_offsets, segments_active_low, digits_active_low)) {
+        return 1;
+    }
+    segledd_stage(&d, "");
+
+    // Stop cleanly on the usual signals, without restarting reads of
+    // the standard input, so that the main thread notices too.
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = segledd_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Keep page faults out of the scanning thread, and run it under the
+    // real-time scheduling policy if permitted.  The signals are blocked
+    // while it starts, so that it inherits them blocked and they are only
+    // ever taken by this thread, which would otherwise be left waiting
+    // for input.
+    (void)mlockall(MCL_CURRENT | MCL_FUTURE);
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = priority;
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&scanner, &attr, segledd_scan, &d);
+    if (ret == EPERM) {
+        fprintf(stderr, "segledd: not permitted to use SCHED_FIFO; scanning may flicker\n");
+        ret = pthread_create(&scanner, NULL, segledd_scan, &d);
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    if (ret) {
+        fprintf(stderr, "segledd: unable to start scanning: %s\n", strerror(ret));
+        return 1;
+    }
+
+    // Show each line read, until the end of the input, and then keep
+    // showing the last one until stopped.
+    while (
+        !segledd_stopping
+        && fgets(line, sizeof(line), stdin)
+    ) {
+        segledd_stage(&d, line);
+    }
+    while (!segledd_stopping) {
+        pause();
+    }
+    pthread_join(scanner, NULL);
+    if (d.errors) {
+        fprintf(stderr, "segledd: %lu requests to set lines failed\n", d.errors);
+    }
+    close(d.fd);
+    return 0;
+}
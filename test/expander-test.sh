@@ -0,0 +1,57 @@
+#!/bin/sh
+# Checks that a panel whose GPIOs are all on one chip which sleeps (as I2C
+# and SPI expanders such as the PCA9555 do), here simulated by gpio-sim
+# (expander-overlay.dts), has all of them switched in one transfer for each
+# slot.  Every call to the chip's set_multiple operation must come after
+# the levels of all twelve GPIOs of the panel are traced, and its set
+# operation, for one GPIO at a time, must never be called.  gpio-sim never
+# fails a transfer, so the count of failed transfers in debugfs must stay
+# at zero.
+
+. ./lib.sh
+
+PANEL=/sys/bus/platform/devices/segled-expander-test/panel0
+BUS_ERRORS=/sys/kernel/debug/segled-expander-test/panel0-bus_errors
+TRACE_SECONDS=0.5
+
+find_tracing
+probe_module gpio-sim
+load_module ../gpio-segled.ko
+apply_overlay expander-overlay
+wait_for "$PANEL/segments"
+printf '\077\006\133\117' > "$PANEL/segments" || fail "unable to set segments"
+
+at_exit reset_tracing
+echo gpio_sim_set gpio_sim_set_multiple > "$TRACING/set_ftrace_filter" \
+    || fail "unable to trace gpio-sim set operations"
+echo 8192 > "$TRACING/buffer_size_kb"
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/events/gpio/gpio_value/enable"
+echo 1 > "$TRACING/tracing_on"
+echo function > "$TRACING/current_tracer"
+sleep "$TRACE_SECONDS"
+echo 0 > "$TRACING/tracing_on"
+
+result=$(awk '
+    / gpio_value: / { ++values }
+    / gpio_sim_set_multiple / {
+        # The first transfer may have started before tracing did.
+        if (started) {
+            ++transfers
+            if (values != 12) ++partial
+        }
+        started = 1
+        values = 0
+    }
+    / gpio_sim_set <-/ { ++singles }
+    END { printf "%d %d %d\n", transfers, partial, singles }
+' "$TRACING/trace")
+set -- $result
+[ "$1" -gt 0 ] || fail "no transfers traced"
+[ "$2" -eq 0 ] || fail "$2 of $1 transfers didn't switch all the GPIOs of the panel"
+[ "$3" -eq 0 ] || fail "$3 GPIOs switched one at a time"
+pass "$1 slots switched in one transfer each"
+
+[ -f "$BUS_ERRORS" ] || fail "no count of failed transfers in debugfs"
+[ "$(cat "$BUS_ERRORS")" -eq 0 ] || fail "$(cat "$BUS_ERRORS") transfers failed"
+pass "no transfers failed"
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Checks what panels driven by GPIOs show, end to end, on GPIOs simulated
+# by gpio-sim (gpio-sim-overlay.dts): one panel driven directly by its
+# GPIOs, with active-low digit commons, and one driven through a chain of
+# 74HC595 shift registers.  Each is given a known bitmap of segments for
+# each digit, the levels set on their GPIOs are traced, and
+# segled-decode.py rebuilds what each panel showed from the trace.
+
+. ./lib.sh
+
+PANELS=/sys/bus/platform/devices/segled-gpio-sim-test
+TRACE_SECONDS=0.5
+TMP=$(mktemp -d) || fail "unable to make a temporary directory"
+at_exit "rm:-rf:$TMP"
+
+find_tracing
+probe_module gpio-sim
+load_module ../gpio-segled.ko
+apply_overlay gpio-sim-overlay
+wait_for "$PANELS/direct/segments"
+wait_for "$PANELS/shifted/segments"
+
+# Show "0123" and "4567" (one byte of segments for each digit), and give
+# the frames time to be latched.
+printf '\077\006\133\117' > "$PANELS/direct/segments" || fail "unable to set direct panel segments"
+printf '\146\155\175\007' > "$PANELS/shifted/segments" || fail "unable to set shifted panel segments"
+sleep 0.1
+
+cat /sys/kernel/debug/gpio > "$TMP/gpio"
+at_exit "reset_tracing"
+echo 8192 > "$TRACING/buffer_size_kb"
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/events/gpio/gpio_value/enable"
+echo 1 > "$TRACING/tracing_on"
+sleep "$TRACE_SECONDS"
+echo 0 > "$TRACING/tracing_on"
+cp "$TRACING/trace" "$TMP/trace"
+
+./segled-decode.py --gpio "$TMP/gpio" --trace "$TMP/trace" --chip segled-direct \
+    --digits 4 --expect 3f,06,5b,4f \
+    || fail "direct panel didn't show what it was given"
+pass "direct panel shows one digit at a time, with the segments given"
+./segled-decode.py --gpio "$TMP/gpio" --trace "$TMP/trace" --chip segled-shift \
+    --shift 8 --digits 4 --digits-active-low --expect 66,6d,7d,07 \
+    || fail "shift register panel didn't show what it was given"
+pass "shift register panel latches one digit at a time, with the segments given"
@@ -0,0 +1,135 @@
+#!/bin/sh
+# Checks a panel driven by an HT16K33 controller against one emulated by
+# i2c-stub at address 0x70: that the chip is set up, that each frame is
+# written to its display RAM in one block, that the brightness of the
+# panel sets its dimming level (or turns the display off), and that
+# blinking the panel sets the chip's own blinking rate, also when given
+# in a frame.  The i2c-stub adapter has no device tree node, so the
+# overlay (ht16k33-overlay.dts.in) is built here, with its number, which
+# needs dtc.  The display RAM is read back with i2cget (from i2c-tools),
+# and the commands sent to the chip, which i2c-stub doesn't keep, are
+# taken from the smbus_write trace events.
+
+. ./lib.sh
+
+PANEL=/sys/bus/platform/devices/segled-ht16k33-test/panel0
+TMP=$(mktemp -d) || fail "unable to make a temporary directory"
+at_exit "rm:-rf:$TMP"
+
+find_tracing
+probe_module i2c-stub chip_addr=0x70
+probe_module i2c-dev
+load_module ../gpio-segled.ko
+for adapter in /sys/bus/i2c/devices/i2c-*; do
+    if grep -q "SMBus stub driver" "$adapter/name"; then
+        BUS=${adapter##*/i2c-}
+    fi
+done
+[ -n "$BUS" ] || fail "no i2c-stub adapter"
+
+# Gives the command bytes sent to the chip (in hexadecimal) since the
+# trace was last cleared, in order, and clears it.
+commands() {
+    grep -o "i2c-$BUS a=070 f=0000 c=[0-9a-f]* BYTE" "$TRACING/trace" \
+        | sed 's/.*c=\([0-9a-f]*\) BYTE/\1/' \
+        | tr '\n' ' ' \
+        | sed 's/ $//'
+    echo > "$TRACING/trace"
+}
+
+# Checks the commands sent to the chip since the trace was last cleared.
+check_commands() {
+    sent=$(commands)
+    [ "$sent" = "$2" ] || fail "$1: sent commands '$sent', not '$2'"
+    pass "$1: sent commands $2"
+}
+
+# Checks the display RAM of the chip holds the given bytes, from the
+# start.
+check_ram() {
+    ram=""
+    for reg in $(seq 0 15); do
+        ram="$ram $(i2cget -f -y "$BUS" 0x70 "$reg" b | sed 's/^0x//')"
+    done
+    ram=${ram# }
+    [ "$ram" = "$2" ] || fail "$1: display RAM holds '$ram', not '$2'"
+    pass "$1: display RAM holds $2"
+}
+
+at_exit reset_tracing
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/events/smbus/smbus_write/enable"
+echo 1 > "$TRACING/tracing_on"
+
+sed "s/@ADAPTER@/$BUS/" ht16k33-overlay.dts.in > "$TMP/ht16k33-overlay.dts"
+dtc -@ -I dts -O dtb -o "$TMP/ht16k33-overlay.dtbo" "$TMP/ht16k33-overlay.dts" || fail "unable to build overlay"
+apply_overlay ht16k33-overlay "$TMP/ht16k33-overlay.dtbo"
+wait_for "$PANEL/segments"
+sleep 0.1
+
+# Setting up turns on the oscillator, makes the rows outputs and leaves
+# the display off, and the first frame then turns it on, at full
+# brightness.
+check_commands "setup" "21 a0 80 ef 81"
+
+# Show "0123" (one byte of segments for each digit).
+printf '\077\006\133\117' > "$PANEL/segments" || fail "unable to set segments"
+sleep 0.1
+grep -q "i2c-$BUS a=070 f=0000 c=0 I2C_BLOCK_DATA l=16" "$TRACING/trace" \
+    || fail "frame not written in one block"
+pass "frame written in one block"
+check_ram "frame" "3f 00 06 00 5b 00 4f 00 00 00 00 00 00 00 00 00"
+echo > "$TRACING/trace"
+
+# The brightness maps onto the sixteen dimming levels, rounding up.
+echo 50 > "$PANEL/brightness"
+sleep 0.1
+check_commands "brightness 50" "e7 81"
+echo 1 > "$PANEL/brightness"
+sleep 0.1
+check_commands "brightness 1" "e0 81"
+echo 100 > "$PANEL/brightness"
+sleep 0.1
+check_commands "brightness 100" "ef 81"
+
+# Zero turns the display off, and any other brightness back on.
+echo 0 > "$PANEL/brightness"
+sleep 0.1
+check_commands "brightness 0" "80"
+echo 50 > "$PANEL/brightness"
+sleep 0.1
+check_commands "brightness 50 again" "e7 81"
+
+# Blinking picks the chip's blinking rate nearest the period given, which
+# is what the attribute then reads back.
+echo 500 > "$PANEL/blink"
+sleep 0.1
+check_commands "blink 500" "e7 83"
+echo "900 50" > "$PANEL/blink"
+sleep 0.1
+check_commands "blink 900 50" "e7 85"
+[ "$(cat "$PANEL/blink")" = "1000 50" ] || fail "blink 900 50 reads back as '$(cat "$PANEL/blink")'"
+pass "blink 900 50 reads back as 1000 50"
+echo 3000 > "$PANEL/blink"
+sleep 0.1
+check_commands "blink 3000" "e7 87"
+if echo "500 25" > "$PANEL/blink" 2>/dev/null; then
+    fail "blink 500 25 accepted"
+fi
+pass "blink 500 25 refused"
+echo 0 > "$PANEL/blink"
+sleep 0.1
+check_commands "blink 0" "e7 81"
+
+# Blinking given in a frame is sent along with its digits, but the chip
+# can't blink digits on their own, so a frame asking for that is refused
+# whole.
+echo "blink=500:50 digits=4567" > "$PANEL/frame"
+sleep 0.1
+check_ram "frame with blink" "66 00 6d 00 7d 00 07 00 00 00 00 00 00 00 00 00"
+check_commands "frame with blink" "e7 83"
+if echo "digit_blink=0,500 digits=0000" > "$PANEL/frame" 2>/dev/null; then
+    fail "frame with digit_blink accepted"
+fi
+sleep 0.1
+check_ram "frame with digit_blink refused" "66 00 6d 00 7d 00 07 00 00 00 00 00 00 00 00 00"
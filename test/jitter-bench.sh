@@ -0,0 +1,100 @@
+#!/bin/sh
+# Compares how steadily, and at what CPU cost, a four-digit panel on GPIOs
+# simulated by gpio-sim is scanned at 100 Hz by the driver
+# (jitter-overlay.dts) and by segledd (on the same GPIOs, with
+# jitter-sim-overlay.dts).  For each, the levels set on the GPIOs are
+# traced, and segled-jitter.py prints how far the period of each digit
+# strayed from the scanning cycle, with a histogram.
+#
+# The CPU time of the driver is the time spent in its scanning timer
+# callback and work item, from the function graph tracer (traced apart
+# from the jitter, so as not to skew it), which leaves out the cost of
+# the timer interrupt and of scheduling the work.  The CPU time of
+# segledd is that of all its threads, from the scheduler statistics of
+# the process, which takes in its system calls and context switches.
+#
+# Usage: jitter-bench.sh [seconds to measure each for, default 10]
+
+. ./lib.sh
+
+PANEL=/sys/bus/platform/devices/segled-jitter-test/panel0
+SEGLEDD=../segledd
+SECONDS_MEASURED=${1:-10}
+TMP=$(mktemp -d) || fail "unable to make a temporary directory"
+at_exit "rm:-rf:$TMP"
+
+[ -x "$SEGLEDD" ] || fail "$SEGLEDD not built"
+find_tracing
+probe_module gpio-sim
+load_module ../gpio-segled.ko
+at_exit reset_tracing
+echo 16384 > "$TRACING/buffer_size_kb"
+
+# Traces the levels set on GPIOs for the time measured, into the given
+# file.
+trace_gpios() {
+    echo > "$TRACING/trace"
+    echo 1 > "$TRACING/events/gpio/gpio_value/enable"
+    echo 1 > "$TRACING/tracing_on"
+    sleep "$SECONDS_MEASURED"
+    echo 0 > "$TRACING/tracing_on"
+    echo 0 > "$TRACING/events/gpio/gpio_value/enable"
+    cp "$TRACING/trace" "$1"
+}
+
+# Gives the CPU time used so far by all the threads of the given process,
+# in nanoseconds.
+cpu_ns() {
+    cat /proc/"$1"/task/*/schedstat | awk '{ sum += $1 } END { printf "%.0f\n", sum }'
+}
+
+# Prints the CPU time given in nanoseconds, over the time measured.
+print_cpu() {
+    awk -v ns="$1" -v seconds="$SECONDS_MEASURED" 'BEGIN {
+        printf "CPU: %.0f us per second (%.3f%%)\n", ns / seconds / 1000, ns / seconds / 1e7
+    }'
+}
+
+echo "gpio-segled driver:"
+apply_overlay jitter-overlay
+wait_for "$PANEL/digits"
+echo 1234 > "$PANEL/digits"
+sleep 0.5
+cat /sys/kernel/debug/gpio > "$TMP/driver-gpio"
+trace_gpios "$TMP/driver-trace"
+./segled-jitter.py --gpio "$TMP/driver-gpio" --trace "$TMP/driver-trace" --chip segled-jitter --digits 4 \
+    || fail "unable to measure driver jitter"
+
+# Each call traced is one line, with its duration in microseconds just
+# before "us".
+echo gpio_segled_digit_timer_tick execute_update_digits > "$TRACING/set_ftrace_filter" \
+    || fail "unable to trace the driver's scanning"
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/tracing_on"
+echo function_graph > "$TRACING/current_tracer"
+sleep "$SECONDS_MEASURED"
+echo 0 > "$TRACING/tracing_on"
+driver_ns=$(grep -E 'gpio_segled_digit_timer_tick\(\);|execute_update_digits\(\);' "$TRACING/trace" \
+    | awk '{ for (i = 1; i < NF; ++i) if ($(i + 1) == "us") sum += $i } END { printf "%.0f\n", sum * 1000 }')
+echo nop > "$TRACING/current_tracer"
+echo > "$TRACING/set_ftrace_filter"
+print_cpu "$driver_ns"
+remove_overlay jitter-overlay
+
+echo "segledd:"
+apply_overlay jitter-sim-overlay
+chip=$(awk '/^gpiochip/ && /segled-jitter/ { sub(":.*", "", $1); print $1 }' /sys/kernel/debug/gpio)
+[ -n "$chip" ] || fail "no simulated chip for segledd"
+(echo 1234; sleep $((SECONDS_MEASURED + 5))) \
+    | "$SEGLEDD" -c "/dev/$chip" -s 0,1,2,3,4,5,6,7 -d 8,9,10,11 &
+segledd_pid=$!
+at_exit "kill:$segledd_pid"
+sleep 0.5
+kill -0 "$segledd_pid" 2>/dev/null || fail "segledd didn't start"
+cat /sys/kernel/debug/gpio > "$TMP/segledd-gpio"
+before=$(cpu_ns "$segledd_pid")
+trace_gpios "$TMP/segledd-trace"
+after=$(cpu_ns "$segledd_pid")
+./segled-jitter.py --gpio "$TMP/segledd-gpio" --trace "$TMP/segledd-trace" --chip segled-jitter --digits 4 \
+    || fail "unable to measure segledd jitter"
+print_cpu $((after - before))
@@ -0,0 +1,96 @@
+# Helpers shared by the test scripts in this directory.  The scripts are
+# run as root from this directory, after "make" here and in the parent
+# directory, on a kernel which can apply device tree overlays through
+# configfs (as Raspberry Pi kernels can).  Whatever a script loads or
+# applies is taken away again when it exits.
+
+OVERLAYS=/sys/kernel/config/device-tree/overlays
+
+CLEANUP=""
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+pass() {
+    echo "PASS: $*"
+}
+
+cleanup() {
+    for step in $CLEANUP; do
+        $(echo "$step" | tr ':' ' ') 2>/dev/null
+    done
+}
+trap cleanup EXIT
+
+# Runs the given command when the script exits, before those added
+# earlier.  The command may not contain spaces; use ':' in their place.
+at_exit() {
+    CLEANUP="$1 $CLEANUP"
+}
+
+# Loads a module from the given file (with any parameters after it),
+# unless it is already loaded.
+load_module() {
+    name=$(basename "$1" .ko | tr '-' '_')
+    if grep -q "^$name " /proc/modules; then
+        return
+    fi
+    insmod "$@" || fail "unable to load $1"
+    at_exit "rmmod:$name"
+}
+
+# Loads a module shipped with the kernel (with any parameters after it),
+# unless it is already loaded.
+probe_module() {
+    name=$(echo "$1" | tr '-' '_')
+    if grep -q "^$name " /proc/modules; then
+        return
+    fi
+    modprobe "$@" || fail "unable to load $1"
+    at_exit "modprobe:-r:$name"
+}
+
+# Applies the device tree overlay built from the given source file (with
+# no ".dts"), or else from the compiled overlay given after it, and checks
+# that it took.
+apply_overlay() {
+    dtbo=${2:-$1.dtbo}
+    [ -d "$OVERLAYS" ] || fail "no device tree overlays in configfs"
+    [ -f "$dtbo" ] || fail "$dtbo not built"
+    mkdir "$OVERLAYS/segled-$1" || fail "unable to add overlay $1"
+    at_exit "rmdir:$OVERLAYS/segled-$1"
+    cat "$dtbo" > "$OVERLAYS/segled-$1/dtbo"
+    [ "$(cat "$OVERLAYS/segled-$1/status")" = "applied" ] || fail "unable to apply overlay $1"
+}
+
+# Removes a device tree overlay applied by apply_overlay.
+remove_overlay() {
+    rmdir "$OVERLAYS/segled-$1" || fail "unable to remove overlay $1"
+}
+
+# Finds where tracefs is mounted, as TRACING.
+find_tracing() {
+    TRACING=/sys/kernel/tracing
+    [ -f "$TRACING/trace" ] || TRACING=/sys/kernel/debug/tracing
+    [ -f "$TRACING/trace" ] || fail "no tracefs"
+}
+
+# Turns off any tracer, function filter and events set up by a script.
+reset_tracing() {
+    echo nop > "$TRACING/current_tracer"
+    echo > "$TRACING/set_ftrace_filter"
+    echo 0 > "$TRACING/events/enable"
+    echo 1 > "$TRACING/tracing_on"
+}
+
+# Waits up to a second for the given file to appear.
+wait_for() {
+    tries=0
+    while [ ! -e "$1" ]; do
+        tries=$((tries + 1))
+        [ $tries -le 10 ] || fail "$1 never appeared"
+        sleep 0.1
+    done
+}
@@ -0,0 +1,89 @@
+/**
+ * pwm-segled-mock - mock PWM provider for testing gpio-segled
+ *
+ * This is a PWM chip with a single PWM which drives nothing.  It accepts
+ * any state applied to it and keeps it, so that the PWM subsystem lists
+ * the period, duty cycle and whether the PWM is enabled in its debugfs
+ * file ("/sys/kernel/debug/pwm").  This lets the dimming of panels gated
+ * by a PWM ("pwms" in the device tree) be checked without any hardware.
+ *
+ * It binds to a device tree node compatible with "segled,pwm-mock",
+ * which has one PWM cell for the PWM number, one for the period in
+ * nanoseconds, and one for flags ('#pwm-cells = <3>;').
+ */
+
+/**
+ * Prefix all messages from this module with its name.
+ * This needs to be defined before including any kernel headers.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/device.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+#include <linux/pwm.h>
+
+/**
+ * This is called by the PWM subsystem to apply a new state to the PWM.
+ * There is no hardware to change, so any state is accepted as it is.
+ */
+static int pwm_segled_mock_apply(struct pwm_chip* chip, struct pwm_device* pwm, const struct pwm_state* state) {
+    dev_dbg(pwmchip_parent(chip), "pwm%u: %s, period %llu ns, duty %llu ns\n", pwm->hwpwm, state->enabled ? "enabled" : "disabled", state->period, state->duty_cycle);
+    return 0;
+}
+
+static const struct pwm_ops pwm_segled_mock_ops = {
+    .apply = pwm_segled_mock_apply,
+};
+
+/**
+ * This is called by the kernel when a device compatible with this driver
+ * is found in the device tree.
+ */
+static int pwm_segled_mock_probe(struct platform_device* pdev) {
+    struct pwm_chip* chip;
+    int ret;
+
+    chip = devm_pwmchip_alloc(&pdev->dev, 1, 0);
+    if (IS_ERR(chip)) {
+        ret = PTR_ERR(chip);
+        pr_err("unable to allocate PWM chip: error code %d\n", ret);
+        return ret;
+    }
+    chip->ops = &pwm_segled_mock_ops;
+    ret = devm_pwmchip_add(&pdev->dev, chip);
+    if (ret) {
+        pr_err("unable to add PWM chip: error code %d\n", ret);
+        return ret;
+    }
+    return 0;
+}
+
+// Open Firmware (OF) information for this driver
+
+static const struct of_device_id of_pwm_segled_mock_match[] = {
+    { .compatible = "segled,pwm-mock", },
+    {},
+};
+
+MODULE_DEVICE_TABLE(of, of_pwm_segled_mock_match);
+
+// Registration with platform (Linux kernel driver model)
+
+static struct platform_driver pwm_segled_mock_driver = {
+    .probe = pwm_segled_mock_probe,
+    .driver = {
+        .name = "pwm-segled-mock",
+        .of_match_table = of_pwm_segled_mock_match,
+    },
+};
+module_platform_driver(pwm_segled_mock_driver);
+
+// Linux kernel module metadata
+
+MODULE_DESCRIPTION("Mock PWM Provider for Testing GPIO-Based Segmented LED Driver");
+MODULE_AUTHOR("Richard Walters <jubajube@gmail.com>");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_ALIAS("platform:pwm-segled-mock");
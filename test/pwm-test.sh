@@ -0,0 +1,35 @@
+#!/bin/sh
+# Checks that the brightness of a panel gated by a PWM sets the duty cycle
+# of the PWM, using the mock PWM provider (pwm-segled-mock.ko) and a
+# simulated panel dimmed by it (pwm-overlay.dts).  The PWM subsystem lists
+# the state last applied to each PWM in debugfs.
+
+. ./lib.sh
+
+PANEL=/sys/bus/platform/devices/segled-pwm-test/panel0
+PWM_DEBUGFS=/sys/kernel/debug/pwm
+
+load_module ../gpio-segled.ko
+load_module ./pwm-segled-mock.ko
+apply_overlay pwm-overlay
+wait_for "$PANEL/brightness"
+
+# Sets the brightness of the panel, and checks the PWM is enabled with the
+# given duty cycle, in nanoseconds of its 1 ms period.
+check_duty() {
+    echo "$1" > "$PANEL/brightness" || fail "unable to set brightness $1"
+    state=$(sed -n '/segled-pwm-mock/,/^$/p' "$PWM_DEBUGFS" | grep 'pwm-0')
+    case "$state" in
+        *" enabled"*"period: 1000000 ns"*"duty: $2 ns"*)
+            pass "brightness $1 gives duty cycle $2 ns"
+            ;;
+        *)
+            fail "brightness $1 gives PWM state '$state', not duty cycle $2 ns"
+            ;;
+    esac
+}
+
+check_duty 100 1000000
+check_duty 25 250000
+check_duty 60 600000
+check_duty 0 0
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""
+segled-decode - rebuilds what a panel showed from a trace of its GPIOs
+
+This reads the gpio_value trace events recorded while a panel was being
+scanned, and works out what the LEDs of the panel showed from them.  The
+GPIOs of the panel are found by their consumer names ("sa", "d1", "data"
+and so on, as the driver requests them) in a copy of the debugfs GPIO
+listing ("/sys/kernel/debug/gpio") taken before tracing started, which also
+gives their levels at the start of the trace and whether they are
+active-low.  Only the GPIOs of the chip whose label is given are looked at,
+so that panels on other chips can be scanned at the same time.
+
+A panel driven directly by its GPIOs (the "gpio" backend) is decoded from
+the levels of its segment and digit GPIOs after each event.  A panel driven
+through a chain of 74HC595 shift registers is decoded by modelling the
+chain: a rising edge of the clock shifts the data level in at the first
+output, and a rising edge of the latch copies the chain to the outputs.
+
+It checks that no more than one digit is ever lit at a time, that the
+segments of a digit never change while it is lit, and that every digit is
+lit, always with the segments expected of it.
+
+Usage:
+  segled-decode.py --gpio GPIO_LISTING --trace TRACE --chip LABEL
+                   --digits N --expect HEX,HEX,...
+                   [--shift SEGMENTS [--segments-active-low]
+                   [--digits-active-low]]
+
+  --gpio     debugfs GPIO listing taken before tracing
+  --trace    tracefs trace with the gpio_value events
+  --chip     label of the chip with the GPIOs of the panel
+  --digits   number of digits of the panel
+  --expect   segments expected of each digit, from the first
+  --shift    the panel is driven through shift registers, with this many
+             segment outputs ahead of the digit commons
+  --segments-active-low, --digits-active-low
+             shift register outputs are active-low (as in the device tree)
+"""
+
+import argparse
+import re
+import sys
+
+# These are the consumer names of the segment GPIOs of a seven-segment
+# panel, in bit order, as the driver requests them.
+SEG7_CONSUMERS = ["sa", "sb", "sc", "sd", "se", "sf", "sg", "sp"]
+
+# These are the consumer names of the GPIOs driving shift registers.
+SHIFT_CONSUMERS = ["data", "clock", "latch"]
+
+GPIO_LINE = re.compile(r"^\s*gpio-(\d+)\s+\(([^|]*)\|([^)]*)\)\s+(\w+)\s+(\w+)(.*)$")
+TRACE_EVENT = re.compile(r"\s(\d+\.\d+): gpio_value: (\d+)\s+(get|set)\s+(-?\d+)")
+
+
+def read_gpios(path, chip):
+    """
+    This reads the GPIOs of the chip with the given label from a debugfs
+    GPIO listing, giving for each consumer name its GPIO number, level and
+    whether it is active-low.
+    """
+    gpios = {}
+    in_chip = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith("gpiochip"):
+                in_chip = chip in line
+                continue
+            match = GPIO_LINE.match(line)
+            if not (in_chip and match):
+                continue
+            consumer = match.group(3).strip()
+            gpios[consumer] = {
+                "number": int(match.group(1)),
+                "level": 1 if match.group(5) == "hi" else 0,
+                "active_low": "ACTIVE LOW" in match.group(6),
+            }
+    return gpios
+
+
+def read_events(path, numbers):
+    """
+    This reads the levels set on the given GPIO numbers, in order, from a
+    trace, as (time, number, level).
+    """
+    events = []
+    with open(path) as f:
+        for line in f:
+            match = TRACE_EVENT.search(line)
+            if (
+                match
+                and (match.group(3) == "set")
+                and (int(match.group(2)) in numbers)
+            ):
+                events.append((float(match.group(1)), int(match.group(2)), int(match.group(4))))
+    return events
+
+
+def decode_direct(gpios, events, num_digits):
+    """
+    This gives the (segments, digits lit) shown by a panel driven directly
+    by its GPIOs after each event.
+    """
+    segment_gpios = [gpios.get(consumer) for consumer in SEG7_CONSUMERS]
+    digit_gpios = [gpios.get("d%d" % (digit + 1)) for digit in range(num_digits)]
+    if None in digit_gpios or None in segment_gpios[:7]:
+        raise ValueError("segment or digit GPIOs of the panel missing from the GPIO listing")
+    levels = {gpio["number"]: gpio["level"] for gpio in gpios.values()}
+
+    def logical(gpio):
+        if gpio is None:
+            return 0
+        return levels[gpio["number"]] ^ gpio["active_low"]
+
+    for _, number, level in events:
+        levels[number] = level
+        segments = sum(logical(gpio) << bit for bit, gpio in enumerate(segment_gpios))
+        digits = [digit for digit, gpio in enumerate(digit_gpios) if logical(gpio)]
+        yield segments, digits
+
+
+def decode_shift(gpios, events, num_digits, num_segments, segments_invert, digits_invert):
+    """
+    This gives the (segments, digits lit) latched by a chain of shift
+    registers after each rising edge of the latch.  Nothing is given until
+    enough bits have been shifted in to fill the chain.
+    """
+    if any(consumer not in gpios for consumer in SHIFT_CONSUMERS):
+        raise ValueError("shift register GPIOs of the panel missing from the GPIO listing")
+    data, clock, latch = (gpios[consumer] for consumer in SHIFT_CONSUMERS)
+    bits = (num_segments + num_digits + 7) // 8 * 8
+    levels = {gpio["number"]: gpio["level"] for gpio in (data, clock, latch)}
+    chain = 0
+    shifted = 0
+    for _, number, level in events:
+        rising = (level and not levels[number])
+        levels[number] = level
+        if rising and (number == clock["number"]):
+            chain = ((chain << 1) | levels[data["number"]]) & ((1 << bits) - 1)
+            shifted += 1
+        elif rising and (number == latch["number"]) and (shifted >= bits):
+            segments = (chain & ((1 << num_segments) - 1)) ^ segments_invert
+            commons = ((chain >> num_segments) & ((1 << num_digits) - 1)) ^ digits_invert
+            yield segments, [digit for digit in range(num_digits) if commons & (1 << digit)]
+
+
+def check(states, expected):
+    """
+    This checks the states a panel went through, giving a list of the
+    problems found.
+    """
+    problems = []
+    seen = [set() for _ in expected]
+    lit = None
+    for segments, digits in states:
+        if len(digits) > 1:
+            problems.append("digits %s lit at the same time" % ", ".join(str(digit + 1) for digit in digits))
+            lit = None
+            continue
+        if not digits:
+            lit = None
+            continue
+        digit = digits[0]
+        if (lit is not None) and (lit[0] == digit) and (lit[1] != segments):
+            problems.append("segments of digit %d changed from %02x to %02x while lit" % (digit + 1, lit[1], segments))
+        lit = (digit, segments)
+        seen[digit].add(segments)
+    for digit, words in enumerate(seen):
+        if not words:
+            problems.append("digit %d never lit" % (digit + 1))
+        elif words != {expected[digit]}:
+            problems.append("digit %d showed %s, not %02x" % (digit + 1, ", ".join("%02x" % word for word in sorted(words)), expected[digit]))
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Rebuild what a panel showed from a trace of its GPIOs.")
+    parser.add_argument("--gpio", required=True)
+    parser.add_argument("--trace", required=True)
+    parser.add_argument("--chip", required=True)
+    parser.add_argument("--digits", required=True, type=int)
+    parser.add_argument("--expect", required=True)
+    parser.add_argument("--shift", type=int)
+    parser.add_argument("--segments-active-low", action="store_true")
+    parser.add_argument("--digits-active-low", action="store_true")
+    args = parser.parse_args()
+
+    expected = [int(word, 16) for word in args.expect.split(",")]
+    if len(expected) != args.digits:
+        parser.error("--expect needs segments for each of the %d digits" % args.digits)
+    try:
+        gpios = read_gpios(args.gpio, args.chip)
+        events = read_events(args.trace, {gpio["number"] for gpio in gpios.values()})
+        if args.shift is None:
+            states = decode_direct(gpios, events, args.digits)
+        else:
+            states = decode_shift(
+                gpios,
+                events,
+                args.digits,
+                args.shift,
+                ((1 << args.shift) - 1) if args.segments_active_low else 0,
+                ((1 << args.digits) - 1) if args.digits_active_low else 0,
+            )
+        problems = check(states, expected)
+    except (OSError, ValueError) as error:
+        print("segled-decode: %s" % error, file=sys.stderr)
+        return 2
+    if not events:
+        problems.append("no GPIO events traced")
+    for problem in problems[:20]:
+        print(problem)
+    if len(problems) > 20:
+        print("(and %d more)" % (len(problems) - 20))
+    return 1 if problems else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""
+segled-jitter - measures how steadily a panel is scanned from a GPIO trace
+
+This reads the gpio_value trace events recorded while a panel was being
+scanned, finds each time a digit was turned on, and compares the time
+between one turning on of a digit and the next of the same digit with the
+period of the scanning cycle.  It prints how far those periods strayed
+from the scanning cycle (the jitter), as the mean, median, 99th percentile
+and largest deviation, followed by a histogram of the deviations.
+
+The digit GPIOs are found by their line names ("d1", "d2" and so on, as
+given to gpio-sim by "gpio-line-names") in a copy of the debugfs GPIO
+listing ("/sys/kernel/debug/gpio"), among the GPIOs of the chip whose
+label is given, so that the same GPIOs can be found whichever program
+(the driver or segledd) requested them.  Digits are taken to be
+active-high.
+
+Usage:
+  segled-jitter.py --gpio GPIO_LISTING --trace TRACE --chip LABEL
+                   --digits N [--refresh HZ] [--bucket US]
+
+  --gpio     debugfs GPIO listing taken while the lines were requested
+  --trace    tracefs trace with the gpio_value events
+  --chip     label of the chip with the GPIOs of the panel
+  --digits   number of digits of the panel
+  --refresh  refresh rate the panel was scanned at (default 100)
+  --bucket   width of each bar of the histogram in microseconds
+             (default 10)
+"""
+
+import argparse
+import re
+import sys
+
+GPIO_LINE = re.compile(r"^\s*gpio-(\d+)\s+\(([^|]*)\|([^)]*)\)")
+TRACE_EVENT = re.compile(r"\s(\d+\.\d+): gpio_value: (\d+)\s+set\s+(-?\d+)")
+
+# This is how many bars the histogram has, the last one taking in all
+# larger deviations.
+HISTOGRAM_BARS = 20
+
+# This is how many characters wide the longest bar of the histogram is.
+HISTOGRAM_WIDTH = 50
+
+
+def read_digit_gpios(path, chip, num_digits):
+    """
+    This reads the GPIO numbers of the digits of a panel, by their line
+    names, from a debugfs GPIO listing.
+    """
+    names = {}
+    in_chip = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith("gpiochip"):
+                in_chip = chip in line
+                continue
+            match = GPIO_LINE.match(line)
+            if in_chip and match:
+                names[match.group(2).strip()] = int(match.group(1))
+    digits = [names.get("d%d" % (digit + 1)) for digit in range(num_digits)]
+    if None in digits:
+        raise ValueError("digit GPIOs of the panel missing from the GPIO listing")
+    return digits
+
+
+def read_periods(path, digit_gpios):
+    """
+    This gives the time in microseconds between each turning on of a digit
+    and the next turning on of the same digit.
+    """
+    levels = {number: None for number in digit_gpios}
+    last_on = {}
+    periods = []
+    with open(path) as f:
+        for line in f:
+            match = TRACE_EVENT.search(line)
+            if not match:
+                continue
+            number = int(match.group(2))
+            if number not in levels:
+                continue
+            when = float(match.group(1)) * 1e6
+            level = int(match.group(3))
+            if level and (levels[number] == 0):
+                if number in last_on:
+                    periods.append(when - last_on[number])
+                last_on[number] = when
+            levels[number] = level
+    return periods
+
+
+def percentile(values, fraction):
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure how steadily a panel is scanned from a GPIO trace.")
+    parser.add_argument("--gpio", required=True)
+    parser.add_argument("--trace", required=True)
+    parser.add_argument("--chip", required=True)
+    parser.add_argument("--digits", required=True, type=int)
+    parser.add_argument("--refresh", type=float, default=100.0)
+    parser.add_argument("--bucket", type=float, default=10.0)
+    args = parser.parse_args()
+
+    try:
+        periods = read_periods(args.trace, read_digit_gpios(args.gpio, args.chip, args.digits))
+    except (OSError, ValueError) as error:
+        print("segled-jitter: %s" % error, file=sys.stderr)
+        return 2
+    if not periods:
+        print("segled-jitter: no digits turned on twice in the trace", file=sys.stderr)
+        return 1
+
+    cycle_us = 1e6 / args.refresh
+    deviations = sorted(abs(period - cycle_us) for period in periods)
+    print("%d cycles, deviation from %.0f us: mean %.1f us, median %.1f us, 99%% %.1f us, max %.1f us" % (
+        len(deviations),
+        cycle_us,
+        sum(deviations) / len(deviations),
+        percentile(deviations, 0.5),
+        percentile(deviations, 0.99),
+        deviations[-1],
+    ))
+    bars = [0] * HISTOGRAM_BARS
+    for deviation in deviations:
+        bars[min(HISTOGRAM_BARS - 1, int(deviation / args.bucket))] += 1
+    for bar, count in enumerate(bars):
+        label = "%4.0f-%-4.0f us" % (bar * args.bucket, (bar + 1) * args.bucket)
+        if bar == HISTOGRAM_BARS - 1:
+            label = "%4.0f+     us" % (bar * args.bucket)
+        print("  %s %6d %s" % (label, count, "#" * ((count * HISTOGRAM_WIDTH + max(bars) - 1) // max(bars))))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
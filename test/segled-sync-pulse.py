@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""
+segled-sync-pulse - drives a frame sync signal on a GPIO simulated by gpio-sim
+
+This raises a gpio-sim line, by setting its "pull" attribute to
+"pull-up", at the rate given, dropping it again halfway through each
+period, until it is killed.  Each edge is scheduled from the time the
+first one was made, rather than from the last, so that the rate holds
+however late any one edge is.  The process asks for a real-time
+scheduling policy, if it may, to keep those edges late by as little as
+possible.
+
+Usage:
+  segled-sync-pulse.py --pull PULL_ATTRIBUTE --rate HZ
+
+  --pull  "pull" attribute of the gpio-sim line
+          ("/sys/devices/platform/.../sim_gpioN/pull")
+  --rate  rate of the rising edges in Hz
+"""
+
+import argparse
+import os
+import time
+
+
+def main():
+    parser = argparse.ArgumentParser(description="drives a frame sync signal on a GPIO simulated by gpio-sim")
+    parser.add_argument("--pull", required=True)
+    parser.add_argument("--rate", type=float, required=True)
+    args = parser.parse_args()
+
+    try:
+        os.sched_setscheduler(0, os.SCHED_FIFO, os.sched_param(50))
+    except (AttributeError, PermissionError):
+        pass
+
+    half_period_ns = int(1e9 / args.rate / 2)
+    with open(args.pull, "w") as pull:
+        start_ns = time.monotonic_ns()
+        edge = 0
+        while True:
+            delay_ns = start_ns + edge * half_period_ns - time.monotonic_ns()
+            if delay_ns > 0:
+                time.sleep(delay_ns / 1e9)
+            pull.write("pull-up" if edge % 2 == 0 else "pull-down")
+            pull.flush()
+            pull.seek(0)
+            edge += 1
+
+
+if __name__ == "__main__":
+    main()
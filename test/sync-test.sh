@@ -0,0 +1,59 @@
+#!/bin/sh
+# Checks that a panel on GPIOs simulated by gpio-sim (sync-overlay.dts)
+# locks its scanning to a frame sync signal.  The sync line is raised and
+# dropped through its gpio-sim "pull" attribute by segled-sync-pulse.py at
+# 10 Hz, with the panel refreshed at 20 Hz, so that two scanning cycles
+# fit in each sync period.  In each sync mode, the panel must lock, must
+# measure the period of the signal to within 1%, and must keep starting
+# its cycles within the lock window (1% of a cycle) of the signal.  Once
+# the signal stops, the panel must drop the lock.
+
+. ./lib.sh
+
+PANEL=/sys/bus/platform/devices/segled-sync-test/panel0
+SIM=/sys/bus/platform/devices/segled-gpio-sim-sync
+SYNC_LINE=12
+SYNC_RATE_HZ=10
+REFRESH_RATE_HZ=20
+PERIOD_NS=$((1000000000 / SYNC_RATE_HZ))
+WINDOW_NS=$((1000000000 / REFRESH_RATE_HZ / 100))
+
+probe_module gpio-sim
+load_module ../gpio-segled.ko
+apply_overlay sync-overlay
+wait_for "$PANEL/sync_locked"
+PULL=$(echo "$SIM"/gpiochip*/sim_gpio$SYNC_LINE/pull)
+[ -f "$PULL" ] || fail "no pull attribute for the sync line"
+echo $REFRESH_RATE_HZ > "$PANEL/refresh" || fail "unable to set the refresh rate"
+
+./segled-sync-pulse.py --pull "$PULL" --rate $SYNC_RATE_HZ &
+PULSE=$!
+at_exit "kill:$PULSE"
+
+# Checks that the panel locks to the signal in the given mode, and holds
+# the lock for a couple of seconds.
+check_lock() {
+    echo "$1" > "$PANEL/sync_mode" || fail "unable to set sync mode $1"
+    sleep 3
+    [ "$(cat "$PANEL/sync_locked")" = 1 ] || fail "panel didn't lock to the sync signal ($1)"
+    period=$(cat "$PANEL/sync_period")
+    [ $((period - PERIOD_NS)) -le $((PERIOD_NS / 100)) ] && [ $((PERIOD_NS - period)) -le $((PERIOD_NS / 100)) ] \
+        || fail "panel measured a sync period of $period ns, not $PERIOD_NS ns ($1)"
+    samples=0
+    while [ $samples -lt 20 ]; do
+        phase=$(cat "$PANEL/sync_phase_error")
+        [ ${phase#-} -le $WINDOW_NS ] || fail "cycle started $phase ns from the sync signal ($1)"
+        sleep 0.1
+        samples=$((samples + 1))
+    done
+    [ "$(cat "$PANEL/sync_locked")" = 1 ] || fail "panel lost the lock to the sync signal ($1)"
+    pass "panel locks to the sync signal ($1), measuring its period and starting cycles in phase with it"
+}
+
+check_lock pll
+check_lock rephase
+
+kill $PULSE
+sleep 1
+[ "$(cat "$PANEL/sync_locked")" = 0 ] || fail "panel still locked after the sync signal stopped"
+pass "panel drops the lock when the sync signal stops"
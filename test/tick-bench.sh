@@ -0,0 +1,81 @@
+#!/bin/sh
+# Measures how long the scanning of a bus takes per tick of its timer, using
+# the function graph tracer, to show that the work done in a tick grows
+# neither with the number of digits nor with the number of panels on the
+# bus.
+#
+# First, the scanning timer callback is timed for a simulated panel of 4,
+# 8, 16 and 32 digits.  Then, for 1, 2, 4 and 8 panels of 4 digits sharing
+# segment GPIOs simulated by gpio-sim, which sleep, both the timer callback
+# and the work item switching the GPIOs are timed, along with the start of
+# each scanning cycle (gpio_segled_start_cycle) if the compiler left it a
+# function of its own.  Prints a line for each function timed, with the
+# number of digits or panels, the number of calls traced and their mean,
+# median and longest durations in microseconds.  The longest tick is the
+# one starting each scanning cycle, which stages the next frame and so
+# does some work for every digit and panel, but only once per cycle.
+#
+# Usage: tick-bench.sh [seconds to trace each function for, default 2]
+
+. ./lib.sh
+
+DIGITS_PANEL=/sys/bus/platform/devices/segled-tick-bench/panel0
+PANELS=/sys/bus/platform/devices/segled-tick-bench-panels
+SECONDS_TRACED=${1:-2}
+
+# Times the calls of the given function for the time traced, and prints a
+# line for them after the given label.
+time_calls() {
+    echo nop > "$TRACING/current_tracer"
+    echo "$2" > "$TRACING/set_ftrace_filter" || fail "unable to trace $2"
+    echo > "$TRACING/trace"
+    echo 1 > "$TRACING/tracing_on"
+    echo function_graph > "$TRACING/current_tracer"
+    sleep "$SECONDS_TRACED"
+    echo 0 > "$TRACING/tracing_on"
+
+    # Each call is one line, with its duration in microseconds just
+    # before "us".
+    grep "$2();" "$TRACING/trace" \
+        | awk '{ for (i = 1; i < NF; ++i) if ($(i + 1) == "us") print $i }' \
+        | sort -n \
+        | awk -v label="$1 $2" '
+            { d[NR] = $1; sum += $1 }
+            END {
+                if (!NR) exit 1
+                printf "%s %d %.3f %.3f %.3f\n", label, NR, sum / NR, d[int((NR + 1) / 2)], d[NR]
+            }' \
+        || fail "no calls of $2 traced for $1"
+}
+
+find_tracing
+probe_module gpio-sim
+load_module ../gpio-segled.ko
+at_exit reset_tracing
+echo 8192 > "$TRACING/buffer_size_kb"
+
+echo "digits function calls mean_us median_us max_us"
+for digits in 4 8 16 32; do
+    apply_overlay "tick-bench-$digits"
+    wait_for "$DIGITS_PANEL/digits"
+    head -c "$digits" /dev/zero | tr '\0' 8 > "$DIGITS_PANEL/digits"
+    time_calls "$digits" gpio_segled_digit_timer_tick
+    remove_overlay "tick-bench-$digits"
+done
+
+functions="gpio_segled_digit_timer_tick execute_update_digits"
+if grep -q '^gpio_segled_start_cycle\b' "$TRACING/available_filter_functions"; then
+    functions="$functions gpio_segled_start_cycle"
+fi
+echo "panels function calls mean_us median_us max_us"
+for panels in 1 2 4 8; do
+    apply_overlay "tick-bench-panels-$panels"
+    wait_for "$PANELS/panel$((panels - 1))/digits"
+    for digits in "$PANELS"/panel*/digits; do
+        echo 8888 > "$digits"
+    done
+    for function in $functions; do
+        time_calls "$panels" "$function"
+    done
+    remove_overlay "tick-bench-panels-$panels"
+done